@@ -1,6 +1,10 @@
 // Console input and output.
 // Input is from the keyboard or serial port.
 // Output is written to the screen and serial port.
+/*
+ * @revisions
+ *   GJE p5  - consoleread copies out after releasing cons.lock
+ */
 
 #include "types.h"
 #include "defs.h"
@@ -232,13 +236,24 @@ consoleintr(int (*getc)(void))
   }
 }
 
+// Reads at most INPUT_BUF bytes, gathered in a buffer and copied
+// out once cons.lock is dropped: a sibling thread may fork while we
+// sleep, leaving dst copy-on-write, and the kernel can't take that
+// fault holding a spinlock.
+/*
+ * @revisions
+ *   GJE p5  - Copy to the user after releasing the lock
+ */
 int
 consoleread(struct inode *ip, char *dst, int n)
 {
   uint target;
   int c;
+  char buf[INPUT_BUF];
 
   iunlock(ip);
+  if(n > INPUT_BUF)
+    n = INPUT_BUF;
   target = n;
   acquire(&cons.lock);
   while(n > 0){
@@ -259,7 +274,7 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       break;
     }
-    *dst++ = c;
+    buf[target - n] = c;
     --n;
     if(c == '\n')
       break;
@@ -267,6 +282,8 @@ consoleread(struct inode *ip, char *dst, int n)
   release(&cons.lock);
   ilock(ip);
 
+  if(uvmcopyout(myproc()->mm, (uint)dst, buf, target - n) < 0)
+    return -1;
   return target - n;
 }
 
@@ -5,14 +5,36 @@
  *           - add permitptew
  *   GJE p4b - add clone
  *           - add join
+ *   GJE p5  - draw lottery from a per-CPU run queue
+ *           - add stride scheduler and setsched
+ *           - add lapicipi
+ *           - add lapicarm, timerset, setquantum and getkstat
+ *           - add cpuacct
+ *           - add kcache object caches; getpinfo iterates by pid
+ *           - add futex_wait and futex_wake
+ *           - add struct mm; growproc returns the old size
+ *           - add tlbflush
+ *           - add setaffinity
+ *           - add kref, krefs, cowbreak and argwptr for copy-on-write
+ *           - cowbreak becomes uvmfault, which also allocates lazy heap
+ *           - add kallocpages, kfreepages and kfreeblocks
+ *           - add kcache_stat and pipeinit
+ *           - add kalloc_zeroed, kzerofill and kzeroed
+ *           - add uvmcopyout
+ *           - add uvmshrink
  */
 
 struct buf;
 struct context;
+struct cpu;
 struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct kcache;
+struct slabstat;
+struct kstat;
+struct mm;
 struct pstat;
 struct rtcdate;
 struct spinlock;
@@ -78,6 +100,14 @@ char*           kalloc(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kref(char*);
+int             krefs(char*);
+char*           kallocpages(int);
+void            kfreepages(char*, int);
+void            kfreeblocks(uint*);
+char*           kalloc_zeroed(void);
+int             kzerofill(void);
+int             kzeroed(void);
 
 // kbd.c
 void            kbdintr(void);
@@ -87,7 +117,10 @@ void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
+void            lapicipi(int apicid, int vector);
 void            lapicinit(void);
+void            lapicarm(uint);
+extern uint     tscperus;
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -106,6 +139,7 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -117,12 +151,18 @@ int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int				clone(void (*fcn)(void*, void*), void* arg1, 
-					  void* arg2, void* stack); // p4b - kernel threads
+					  void* arg2, void* stack, void* tls); // p4b - kernel threads
 int             join(void** stack);
-struct proc*    getLotteryWinner(void);
-int             getpinfo(struct pstat*); // p2b - scheduler
+struct proc*    getLotteryWinner(struct cpu*);
+struct proc*    getStrideWinner(struct cpu*);
+int             getpinfo(int, struct pstat*); // p2b - scheduler
+int             getkstat(struct kstat*); // p5 - kernel counters
+int             futex_wait(int*, int); // p5 - futexes
+int             futex_wake(int*, int); // p5 - futexes
+int             groupexec(void); // p5 - scheduler
 int             growproc(int);
 int             kill(int);
+void            cpuacct(int user);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
@@ -130,8 +170,12 @@ void            procdump(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
+int             setquantum(int us); // p5 - scheduler
+int             setsched(int policy); // p5 - scheduler
+int             setaffinity(int pid, uint mask); // p5 - scheduler
 int             settickets(int number); // p2b - scheduler
 void            sleep(void*, struct spinlock*);
+void            timerset(void);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
@@ -140,6 +184,12 @@ void            yield(void);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// slab.c
+void            kcache_init(struct kcache*, char*, uint);
+void*           kcache_alloc(struct kcache*);
+void            kcache_free(struct kcache*, void*);
+int             kcache_stat(int, struct slabstat*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -167,6 +217,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -178,6 +229,7 @@ void            timerinit(void);
 // trap.c
 void            idtinit(void);
 extern uint     ticks;
+extern uint64   nexttick;
 void            tvinit(void);
 extern struct spinlock tickslock;
 
@@ -203,6 +255,15 @@ int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 void            clearptew(pde_t *pgdir, char *uva);
 void            permitptew(pde_t *pgdir, char *uva);
+void            mminit(void);
+struct mm*      mmalloc(pde_t*, uint);
+struct mm*      mmdup(struct mm*);
+void            mmput(struct mm*);
+void            tlbflush(struct mm*);
+int             uvmfault(struct mm*, uint, uint, int);
+int             uvmcopyout(struct mm*, uint, void*, uint);
+uint            uvmshrink(struct mm*, uint, uint);
+void            tlbflushintr(void);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -1,6 +1,9 @@
 /*
  * Revisions:
  *   GJE p3b - add protected page to user virtual address space
+ *   GJE p5  - drop the thread-local storage segment
+ *           - give up this thread's reference to the old struct mm
+ *           - move a thread that execs into a ticket group of its own
  */ 
 
 #include "types.h"
@@ -11,12 +14,16 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "mm.h"
 
 #define NULL ((void*)0)
 
 /*
  * Revisions:
  *   GJE p3b - add protected page to user virtual address space
+ *   GJE p5  - leave the ticket group of a shared address space
  */
 int
 exec(char *path, char **argv)
@@ -27,7 +34,8 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
+  pde_t *pgdir;
+  struct mm *mm, *oldmm;
   struct proc *curproc = myproc();
 
   begin_op();
@@ -105,6 +113,14 @@ exec(char *path, char **argv)
   sp -= (3+argc+1) * 4;
   if(copyout(pgdir, sp, ustack, (3+argc+1)*4) < 0)
     goto bad;
+  if((mm = mmalloc(pgdir, sz)) == 0)
+    goto bad;
+  // A thread leaving a shared address space leaves its ticket group too.
+  if(groupexec() < 0){
+    mmput(mm);
+    pgdir = 0;
+    goto bad;
+  }
 
   // Save program name for debugging.
   for(last=s=path; *s; s++)
@@ -112,14 +128,15 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
-  // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
+  // Commit to the user image. Other threads keep the old one.
+  oldmm = curproc->mm;
+  curproc->mm = mm;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
+  curproc->tf->gs = 0;
+  curproc->tls = 0;
   switchuvm(curproc);
-  freevm(oldpgdir);
+  mmput(oldmm);
   return 0;
 
  bad:
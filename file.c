@@ -1,6 +1,11 @@
 //
 // File descriptors
 //
+/*
+ * @revisions
+ *   GJE p5  - allocate open files from an object cache, up to NFILE,
+ *             instead of a fixed table
+ */
 
 #include "types.h"
 #include "defs.h"
@@ -9,35 +14,45 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kcache filecache;
+  int nfile;              // Files allocated, at most NFILE
 } ftable;
 
+/*
+ * @revisions
+ *   GJE p5  - Set up the file cache
+ */
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  kcache_init(&ftable.filecache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
+/*
+ * @revisions
+ *   GJE p5  - Take it from the file cache
+ */
 struct file*
 filealloc(void)
 {
   struct file *f;
 
   acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
+  if(ftable.nfile >= NFILE || (f = kcache_alloc(&ftable.filecache)) == 0){
+    release(&ftable.lock);
+    return 0;
   }
+  ftable.nfile++;
+  f->ref = 1;
   release(&ftable.lock);
-  return 0;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -53,6 +68,10 @@ filedup(struct file *f)
 }
 
 // Close file f.  (Decrement ref count, close when reaches 0.)
+/*
+ * @revisions
+ *   GJE p5  - Return it to the file cache
+ */
 void
 fileclose(struct file *f)
 {
@@ -68,7 +87,9 @@ fileclose(struct file *f)
   ff = *f;
   f->ref = 0;
   f->type = FD_NONE;
+  ftable.nfile--;
   release(&ftable.lock);
+  kcache_free(&ftable.filecache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
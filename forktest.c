@@ -1,11 +1,13 @@
 // Test that fork fails gracefully.
 // Tiny executable so that the limit can be filling the proc table.
 
+#include "param.h"
 #include "types.h"
 #include "stat.h"
 #include "user.h"
 
-#define N  1000
+// More than fit in the proc table, whatever NPROC is.
+#define N  (NPROC + 1)
 
 void
 printf(int fd, const char *s, ...)
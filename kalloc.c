@@ -1,6 +1,18 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and physically
+// contiguous blocks of 2^order pages up to 2^MAXORDER.
+/*
+ * @revisions
+ *   GJE p5  - count references to each page so user pages can be
+ *             shared copy-on-write; kref() and krefs()
+ *           - per-cpu caches of free pages, refilled from and drained
+ *             to the shared free list a batch at a time
+ *           - buddy allocator behind the shared free list;
+ *             kallocpages(), kfreepages() and kfreeblocks()
+ *           - pool of pages zeroed by idle cpus for kalloc_zeroed();
+ *             junk fill on free only with KALLOC_DEBUG
+ */
 
 #include "types.h"
 #include "defs.h"
@@ -8,21 +20,66 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "x86.h"
+
+// Pages moved between a cpu's cache and the buddy allocator at a time.
+// A cache holding 2*KBATCH pages gives KBATCH back.
+#define KBATCH 32
+
+// Most pages idle cpus zero ahead of kalloc_zeroed().
+#define ZPOOLMAX 256
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+// A free page or block, linked through its first words. Per-cpu
+// caches use only next.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+// Free memory as buddy blocks: a block of 2^k pages is aligned to
+// its size in physical memory, and its buddy is the block it was
+// split from, found by flipping bit k of the page number. Blocks
+// are coalesced with their buddies as they're freed.
 struct {
   struct spinlock lock;
-  int use_lock;
-  struct run *freelist;
+  volatile int use_lock;         // Set once kinit2() is done
+  struct run *free[MAXORDER+1];  // Free blocks of each order
+  uint nfree[MAXORDER+1];        // Number of blocks on each list
 } kmem;
 
+// For the first page of each free block, its order plus one;
+// 0 for every other page. Protected by kmem.lock.
+static uchar freeorder[PHYSTOP / PGSIZE];
+#define FREEORDER(pa) (freeorder[(pa) / PGSIZE])
+
+// Each cpu's cache of free pages, touched only by that cpu with
+// interrupts off, and kept on its own cache line. Pages in one cache
+// can't be handed out by another, so up to 2*KBATCH per cpu sit idle
+// when memory is short.
+struct kcpu {
+  struct run *freelist;
+  int nfree;
+} __attribute__((__aligned__(64)));
+
+static struct kcpu kcpus[NCPU];
+
+// Pages zeroed but for their link word, filled by kzerofill() in
+// idle time. Each holds the reference kalloc() gave it.
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int n;
+} zpool;
+
+// References to each physical page: page tables mapping it, plus one
+// for the kernel's own use. Updated atomically, without kmem.lock.
+static int pageref[PHYSTOP / PGSIZE];
+#define PAGEREF(v) (pageref[V2P(v) / PGSIZE])
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -32,6 +89,7 @@ void
 kinit1(void *vstart, void *vend)
 {
   initlock(&kmem.lock, "kmem");
+  initlock(&zpool.lock, "zpool");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -51,46 +109,441 @@ freerange(void *vstart, void *vend)
   for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
     kfree(p);
 }
+/*
+ * Takes a free block off its list. Caller holds kmem.lock.
+ * @param pa Physical address of the block
+ * @param order Its order
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void buddyunlink(uint pa, int order)
+{
+	struct run* r = (struct run*)P2V(pa);
+
+	if (r->prev)
+	{
+		r->prev->next = r->next;
+	}
+	else
+	{
+		kmem.free[order] = r->next;
+	}
+	if (r->next)
+	{
+		r->next->prev = r->prev;
+	}
+	FREEORDER(pa) = 0;
+	kmem.nfree[order]--;
+}
+
+/*
+ * Puts a free block on its list. Caller holds kmem.lock.
+ * @param pa Physical address of the block
+ * @param order Its order
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void buddylink(uint pa, int order)
+{
+	struct run* r = (struct run*)P2V(pa);
+
+	r->prev = 0;
+	r->next = kmem.free[order];
+	if (r->next)
+	{
+		r->next->prev = r;
+	}
+	kmem.free[order] = r;
+	FREEORDER(pa) = order + 1;
+	kmem.nfree[order]++;
+}
+
+/*
+ * Frees a block, merging it with its buddy for as long as the buddy
+ * is free and whole. Caller holds kmem.lock.
+ * @param pa Physical address of the block
+ * @param order Its order
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void buddyfree(uint pa, int order)
+{
+	uint buddy;
+
+	for (; order < MAXORDER; order++)
+	{
+		buddy = pa ^ (PGSIZE << order);
+		if (buddy >= PHYSTOP || FREEORDER(buddy) != order + 1)
+		{
+			break;
+		}
+		buddyunlink(buddy, order);
+		pa &= ~(PGSIZE << order);
+	}
+	buddylink(pa, order);
+}
+
+/*
+ * Allocates a block, splitting the smallest larger one available and
+ * freeing the halves it doesn't use. Caller holds kmem.lock.
+ * @param order Order of the block
+ * @returns its kernel address, 0 if none is free
+ * @revisions
+ *   GJE p5  - Created
+ */
+static char* buddyalloc(int order)
+{
+	uint pa;
+	int k;
+
+	for (k = order; k <= MAXORDER && kmem.free[k] == 0; k++)
+		;
+	if (k > MAXORDER)
+	{
+		return 0;
+	}
+	pa = V2P(kmem.free[k]);
+	buddyunlink(pa, k);
+	while (k > order)
+	{
+		k--;
+		buddylink(pa + (PGSIZE << k), k);
+	}
+	return (char*)P2V(pa);
+}
+
+/*
+ * Moves up to KBATCH pages from the buddy allocator to a cpu's
+ * cache. Caller is running on that cpu with interrupts off.
+ * @param kc The cpu's cache
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void krefill(struct kcpu* kc)
+{
+	struct run* r;
+
+	acquire(&kmem.lock);
+	while (kc->nfree < KBATCH && (r = (struct run*)buddyalloc(0)) != 0)
+	{
+		r->next = kc->freelist;
+		kc->freelist = r;
+		kc->nfree++;
+	}
+	release(&kmem.lock);
+}
+
+/*
+ * Gives KBATCH pages from a cpu's cache back to the buddy allocator.
+ * Caller is running on that cpu with interrupts off, and the cache
+ * holds more than KBATCH.
+ * @param kc The cpu's cache
+ * @revisions
+ *   GJE p5  - Created
+ *           - Free each page to the buddy allocator
+ */
+static void kdrain(struct kcpu* kc)
+{
+	struct run* r;
+
+	acquire(&kmem.lock);
+	for (int i = 0; i < KBATCH; i++)
+	{
+		r = kc->freelist;
+		kc->freelist = r->next;
+		buddyfree(V2P(r), 0);
+	}
+	release(&kmem.lock);
+	kc->nfree -= KBATCH;
+}
+
+/*
+ * Takes a page from the zeroed pool. Called once other cpus may be
+ * running, after kinit2().
+ * @returns a zeroed page with one reference, 0 if the pool is empty
+ * @revisions
+ *   GJE p5  - Created
+ */
+static char* kzeroget(void)
+{
+	struct run* r;
+
+	acquire(&zpool.lock);
+	if ((r = zpool.freelist) != 0)
+	{
+		zpool.freelist = r->next;
+		zpool.n--;
+	}
+	release(&zpool.lock);
+	if (r)
+	{
+		r->next = 0;
+	}
+	return (char*)r;
+}
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
+// Drop a reference to the page of physical memory pointed at by v,
+// and free it with the last one. v normally should have been
+// returned by a call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+/*
+ * @revisions
+ *   GJE p5  - Free only once the last reference is gone
+ *           - Free to this cpu's cache
+ */
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcpu *kc;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(fetch_and_add(&PAGEREF(v), -1) > 1)
+    return;
+  PAGEREF(v) = 0;
+
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  // Until kinit2() is done the allocator is the boot cpu's alone:
+  // mycpu() may not work yet, and the other cpus, though started,
+  // have nothing to allocate for (see kzerofill()).
+  if(!kmem.use_lock){
+    buddyfree(V2P(v), 0);
+    return;
+  }
+
+  pushcli();
+  kc = &kcpus[cpuid()];
+  r->next = kc->freelist;
+  kc->freelist = r;
+  if(++kc->nfree >= 2*KBATCH)
+    kdrain(kc);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+/*
+ * @revisions
+ *   GJE p5  - The page starts with one reference
+ *           - Allocate from this cpu's cache
+ *           - Fall back on the zeroed pool
+ */
 char*
 kalloc(void)
 {
   struct run *r;
+  struct kcpu *kc;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock){
+    r = (struct run*)buddyalloc(0);
+  } else {
+    pushcli();
+    kc = &kcpus[cpuid()];
+    if(kc->freelist == 0)
+      krefill(kc);
+    r = kc->freelist;
+    if(r){
+      kc->freelist = r->next;
+      kc->nfree--;
+    }
+    popcli();
+    if(r == 0)
+      return kzeroget();
+  }
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    PAGEREF(r) = 1;
   return (char*)r;
 }
 
+/*
+ * Takes another reference to an allocated page, for a page table that
+ * shares it; kfree() drops it.
+ * @param v Kernel address of the page
+ * @revisions
+ *   GJE p5  - Created
+ */
+void kref(char* v)
+{
+	if ((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+	{
+		panic("kref");
+	}
+	fetch_and_add(&PAGEREF(v), 1);
+}
+
+/*
+ * Counts the references to an allocated page.
+ * @param v Kernel address of the page
+ * @returns the count; 1 means the caller's is the only one
+ * @revisions
+ *   GJE p5  - Created
+ */
+int krefs(char* v)
+{
+	return PAGEREF(v);
+}
+
+
+/*
+ * Allocates 2^order physically contiguous pages, aligned to their
+ * size. Order 0 is a kalloc().
+ * @param order Order of the block, 0 to MAXORDER
+ * @returns the block's kernel address, 0 if none is free
+ * @revisions
+ *   GJE p5  - Created
+ */
+char* kallocpages(int order)
+{
+	char* v;
+
+	if (order < 0 || order > MAXORDER)
+	{
+		panic("kallocpages");
+	}
+	if (order == 0)
+	{
+		return kalloc();
+	}
+	if (kmem.use_lock)
+	{
+		acquire(&kmem.lock);
+	}
+	v = buddyalloc(order);
+	if (kmem.use_lock)
+	{
+		release(&kmem.lock);
+	}
+	if (v)
+	{
+		PAGEREF(v) = 1;
+	}
+	return v;
+}
+
+/*
+ * Frees a block from kallocpages(). Order 0 is a kfree(); larger
+ * blocks aren't shared, so they have only the one reference.
+ * @param v Kernel address of the block
+ * @param order Order it was allocated with
+ * @revisions
+ *   GJE p5  - Created
+ */
+void kfreepages(char* v, int order)
+{
+	if (order == 0)
+	{
+		kfree(v);
+		return;
+	}
+	if (order < 0 || order > MAXORDER || V2P(v) % (PGSIZE << order)
+		|| v < end || V2P(v) + (PGSIZE << order) > PHYSTOP || PAGEREF(v) != 1)
+	{
+		panic("kfreepages");
+	}
+	PAGEREF(v) = 0;
+
+#ifdef KALLOC_DEBUG
+	// Fill with junk to catch dangling refs.
+	memset(v, 1, PGSIZE << order);
+#endif
+
+	acquire(&kmem.lock);
+	buddyfree(V2P(v), order);
+	release(&kmem.lock);
+}
+
+/*
+ * Counts the free blocks of each order. Pages in per-cpu caches are
+ * free too, but not counted.
+ * @param counts OUTPUT MAXORDER+1 counts, by order; may be user
+ *               memory, so it is written without kmem.lock held
+ * @revisions
+ *   GJE p5  - Created
+ */
+void kfreeblocks(uint* counts)
+{
+	uint nfree[MAXORDER + 1];
+
+	acquire(&kmem.lock);
+	memmove(nfree, kmem.nfree, sizeof(nfree));
+	release(&kmem.lock);
+	memmove(counts, nfree, sizeof(nfree));
+}
+
+/*
+ * Allocates a page of zeroes: from the pool idle cpus fill if it has
+ * any, else zeroed now.
+ * @returns the page's kernel address, 0 if out of memory
+ * @revisions
+ *   GJE p5  - Created
+ */
+char* kalloc_zeroed(void)
+{
+	char* v;
+
+	if (kmem.use_lock && (v = kzeroget()) != 0)
+	{
+		return v;
+	}
+	if ((v = kalloc()) != 0)
+	{
+		memset(v, 0, PGSIZE);
+	}
+	return v;
+}
+
+/*
+ * Zeroes a page for the pool, if it isn't full. Idle cpus call it
+ * from the scheduler, a page at a time so they can stop for work.
+ * @returns 1 if it added a page, 0 if the pool is full, memory is
+ *          short or the allocator is still being set up
+ * @revisions
+ *   GJE p5  - Created
+ *           - Wait for kinit2()
+ */
+int kzerofill(void)
+{
+	struct run* r;
+
+	// Other cpus idle before kinit2() has finished freeing memory
+	// without the lock; leave the allocator alone until it has.
+	if (!kmem.use_lock || zpool.n >= ZPOOLMAX
+		|| (r = (struct run*)kalloc()) == 0)
+	{
+		return 0;
+	}
+	memset(r, 0, PGSIZE);
+
+	acquire(&zpool.lock);
+	if (zpool.n >= ZPOOLMAX)
+	{
+		release(&zpool.lock);
+		kfree((char*)r);
+		return 0;
+	}
+	r->next = zpool.freelist;
+	zpool.freelist = r;
+	zpool.n++;
+	release(&zpool.lock);
+	return 1;
+}
+
+/*
+ * Counts the pages waiting in the zeroed pool
+ * @returns the count
+ * @revisions
+ *   GJE p5  - Created
+ */
+int kzeroed(void)
+{
+	return zpool.n;
+}
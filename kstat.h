@@ -0,0 +1,37 @@
+/*
+ * Definition of kstat struct: kernel-wide counters reported by getkstat()
+ * 
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ *           - add wakeups and woken
+ *           - add freeblocks
+ *           - add zeroed
+ */
+
+#ifndef _KSTAT_H_
+#define _KSTAT_H_
+
+#include "param.h"
+
+struct kstat
+{
+	/* the number of cpus running */
+	int ncpu;
+	/* clock ticks since boot */
+	uint ticks;
+	/* the timer interrupts taken by each cpu */
+	uint timerintr[NCPU];
+	/* all interrupts (timer, device and IPI) taken by each cpu */
+	uint intr[NCPU];
+	/* calls to wakeup(), and the sleeping processes they woke */
+	uint wakeups;
+	uint woken;
+	/* free blocks of 2^order pages in the page allocator, by order */
+	uint freeblocks[MAXORDER + 1];
+	/* pages idle cpus have zeroed ahead of kalloc_zeroed() */
+	uint zeroed;
+};
+
+#endif // _KSTAT_H_
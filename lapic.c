@@ -41,7 +41,17 @@
 #define TCCR    (0x0390/4)   // Timer Current Count
 #define TDCR    (0x03E0/4)   // Timer Divide Configuration
 
+// 8253/8254 programmable interval timer, channel 2, used as the
+// reference clock when calibrating the lapic timer and the TSC.
+#define PIT_HZ     1193182      // PIT input clock
+#define PIT_CH2    0x42         // Channel 2 data port
+#define PIT_MODE   0x43         // Mode/command register
+#define PIT_GATE   0x61         // Channel 2 gate (bit 0) and output (bit 5)
+#define CALIBRATE_US 10000      // Length of the calibration interval
+
 volatile uint *lapic;  // Initialized in mp.c
+uint lapicperus;       // Lapic timer counts per microsecond
+uint tscperus;         // TSC cycles per microsecond
 
 //PAGEBREAK!
 static void
@@ -51,6 +61,42 @@ lapicw(int index, int value)
   lapic[ID];  // wait for write to finish, by reading
 }
 
+// Measure how fast the lapic timer and the TSC run by counting both
+// across CALIBRATE_US of PIT channel 2. Every cpu shares the same bus
+// clock, so the boot cpu does this once for all of them.
+static void
+calibrate(void)
+{
+  uint count, lapic0, i;
+  uint64 tsc0, tsc1;
+
+  // Gate channel 2 on with the speaker off, then load a one-shot
+  // count (mode 0); its output goes high at terminal count.
+  outb(PIT_GATE, (inb(PIT_GATE) & ~0x02) | 0x01);
+  outb(PIT_MODE, 0xB0);
+  count = PIT_HZ / (1000000 / CALIBRATE_US);
+  outb(PIT_CH2, count & 0xFF);
+  outb(PIT_CH2, count >> 8);
+
+  lapicw(TIMER, MASKED);
+  lapicw(TICR, 0xFFFFFFFF);
+  lapic0 = lapic[TCCR];
+  tsc0 = rdtsc();
+  for(i = 0; i < 0x10000000 && (inb(PIT_GATE) & 0x20) == 0; i++)
+    ;
+  tsc1 = rdtsc();
+  lapicperus = (lapic0 - lapic[TCCR]) / CALIBRATE_US;
+  tscperus = (uint)(tsc1 - tsc0) / CALIBRATE_US;
+  lapicw(TICR, 0);
+
+  // No PIT: fall back to the 1GHz bus the old fixed TICR assumed.
+  if(i == 0x10000000 || lapicperus == 0 || tscperus == 0){
+    cprintf("lapic: timer calibration failed\n");
+    lapicperus = 1000;
+    tscperus = 1000;
+  }
+}
+
 void
 lapicinit(void)
 {
@@ -60,13 +106,15 @@ lapicinit(void)
   // Enable local APIC; set spurious interrupt vector.
   lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
 
-  // The timer repeatedly counts down at bus frequency
-  // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // The timer counts down once at bus frequency from lapic[TICR]
+  // and then issues an interrupt. TICR is calibrated against the
+  // PIT, and the scheduler rearms it through lapicarm() for the
+  // next event this cpu needs; start with one clock tick.
   lapicw(TDCR, X1);
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  if(lapicperus == 0)
+    calibrate();
+  lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+  lapicw(TICR, TICKUS * lapicperus);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -113,6 +161,34 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send interrupt vector to the cpu with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
+// Interrupt this cpu once, us microseconds from now.
+// An interval of 0 disarms the timer.
+void
+lapicarm(uint us)
+{
+  uint count;
+
+  if(!lapic)
+    return;
+  if(us > 0xFFFFFFFF / lapicperus)
+    count = 0xFFFFFFFF;
+  else
+    count = us * lapicperus;
+  lapicw(TICR, count);
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
@@ -0,0 +1,26 @@
+/*
+ * Definition of mm struct: a user address space, shared by the
+ * threads clone() makes
+ * 
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ *           - add mask of cpus with the page table loaded
+ */
+
+#ifndef _MM_H_
+#define _MM_H_
+
+// Every process points to one; clone() shares its parent's and fork()
+// and exec() make a new one. The last reference dropped frees the page
+// tables and the memory they map.
+struct mm {
+  struct sleeplock lock;       // Held while growing or copying the space
+  int ref;                     // Processes pointing here; atomic
+  pde_t *pgdir;                // Page table
+  uint sz;                     // Size of user memory (bytes)
+  volatile uint cpus;          // Bit i set while cpus[i] has pgdir loaded
+};
+
+#endif // _MM_H_
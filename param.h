@@ -1,4 +1,6 @@
-#define NPROC        64  // maximum number of processes
+#ifndef NPROC
+#define NPROC      1024  // maximum number of processes
+#endif
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
@@ -10,5 +12,10 @@
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define FSSIZE       2000  // size of file system in blocks
+#define MAXORDER       10  // largest kallocpages() block is 2^MAXORDER pages
+#define TICKUS      10000  // microseconds per clock tick (ticks)
+#ifndef QUANTUM
+#define QUANTUM     10000  // default scheduling quantum in microseconds
+#endif
 
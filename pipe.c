@@ -1,3 +1,9 @@
+/*
+ * @revisions
+ *   GJE p5  - allocate pipes from an object cache rather than a
+ *             page each
+ *           - piperead copies out after releasing the pipe lock
+ */
 #include "types.h"
 #include "defs.h"
 #include "param.h"
@@ -7,6 +13,7 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
 
 #define PIPESIZE 512
 
@@ -19,6 +26,23 @@ struct pipe {
   int writeopen;  // write fd is still open
 };
 
+// A struct pipe is about 600 bytes; a page held one.
+static struct kcache pipecache;
+
+/*
+ * Sets up the cache pipes come from
+ * @revisions
+ *   GJE p5  - Created
+ */
+void pipeinit(void)
+{
+	kcache_init(&pipecache, "pipe", sizeof(struct pipe));
+}
+
+/*
+ * @revisions
+ *   GJE p5  - Take the pipe from the pipe cache
+ */
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,7 +52,7 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc()) == 0)
+  if((p = kcache_alloc(&pipecache)) == 0)
     goto bad;
   p->readopen = 1;
   p->writeopen = 1;
@@ -48,7 +72,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    kcache_free(&pipecache, p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -56,6 +80,10 @@ pipealloc(struct file **f0, struct file **f1)
   return -1;
 }
 
+/*
+ * @revisions
+ *   GJE p5  - Return the pipe to the pipe cache
+ */
 void
 pipeclose(struct pipe *p, int writable)
 {
@@ -69,7 +97,7 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    kcache_free(&pipecache, p);
   } else
     release(&p->lock);
 }
@@ -97,11 +125,21 @@ pipewrite(struct pipe *p, char *addr, int n)
   return n;
 }
 
+// Copies out through a buffer once p->lock is dropped: a sibling
+// thread may fork while we sleep, leaving addr copy-on-write, and
+// the kernel can't take that fault holding a spinlock.
+/*
+ * @revisions
+ *   GJE p5  - Copy to the user after releasing the lock
+ */
 int
 piperead(struct pipe *p, char *addr, int n)
 {
   int i;
+  char buf[PIPESIZE];
 
+  if(n > PIPESIZE)
+    n = PIPESIZE;
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
     if(myproc()->killed){
@@ -113,9 +151,11 @@ piperead(struct pipe *p, char *addr, int n)
   for(i = 0; i < n; i++){  //DOC: piperead-copy
     if(p->nread == p->nwrite)
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    buf[i] = p->data[p->nread++ % PIPESIZE];
   }
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
+  if(uvmcopyout(myproc()->mm, (uint)addr, buf, i) < 0)
+    return -1;
   return i;
 }
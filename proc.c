@@ -5,6 +5,29 @@
  *           - add join()
  *           - only wait() for processes with separate address space
  *           - grow all threads sharing address space when increasing one
+ *   GJE p5  - per-CPU run queues for the lottery scheduler
+ *           - O(log n) lottery draw from a Fenwick tree of tickets
+ *           - stride scheduling policy
+ *           - draw lottery numbers from the cpu's own generator
+ *           - work stealing between cpu run queues
+ *           - halt idle cpus; wake them with an IPI when work arrives
+ *           - one-shot timer per quantum, and none when there is no one
+ *             to preempt for; setquantum() and getkstat()
+ *           - compensation tickets for processes that leave the cpu early
+ *           - fund threads sharing an address space from one ticket group
+ *           - account user, system and wait time with the TSC
+ *           - pid hash, child and thread lists instead of table scans
+ *           - hashed wait channels for sleep and wakeup
+ *           - allocate processes and ticket groups from object caches
+ *           - futex_wait() and futex_wake()
+ *           - thread-local storage segment for clone()d threads
+ *           - threads share a reference counted struct mm
+ *           - requeue processes on the cpu that last ran them;
+ *             setaffinity()
+ *           - copy-on-write fork; futexes keyed by address space
+ *           - sbrk() growth is allocated on demand
+ *           - exec() out of a shared address space leaves its ticket group
+ *           - run queues grow with the process count instead of holding NPROC
  */
 
 #include "types.h"
@@ -15,26 +38,108 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "slab.h"
+#include "mm.h"
 #include "pstat.h"
+#include "kstat.h"
 #include "rand.h"
-
+#include "sched.h"
+#include "traps.h"
+
+// Processes sharing an address space (threads made by clone()) are
+// funded from one pool of tickets, split evenly among the live ones,
+// so spawning threads doesn't multiply a process's share of the cpu.
+struct tgroup {
+  int nthreads;                // Live processes in the group; 0 if free
+  int tickets;                 // Funding shared by the group
+  struct proc *threads;        // The live processes, via proc.threadnext
+};
+
+// Buckets in the pid -> proc hash table; a power of two.
+#define NPIDHASH 64
+#define PIDHASH(pid) ((pid) & (NPIDHASH - 1))
+
+// Buckets of sleeping processes keyed by wait channel; a power of two.
+#define NCHANHASH 64
+#define CHANHASH(chan) \
+  ((((uint)(chan) >> 4) ^ ((uint)(chan) >> 12)) & (NCHANHASH - 1))
+
+// Processes are allocated from proccache, up to NPROC of them, and
+// kept on the allproc list in order of pid.
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct kcache proccache;
+  struct kcache groupcache;
+  struct proc *allproc;        // Oldest process, via proc.allnext
+  struct proc *alltail;        // Newest process
+  int nproc;                   // Processes allocated
+  struct proc *pidhash[NPIDHASH];  // Chained through proc.pidnext
+  struct proc *chanhash[NCHANHASH];  // Sleepers, through proc.channext
+  uint wakeups;                // Calls to wakeup1()
+  uint woken;                  // Processes those calls made RUNNABLE
 } ptable;
 
 static struct proc *initproc;
 
+// How often, in timer ticks, a cpu compares its load with the others.
+#define BALANCE_TICKS 10
+
+// A cpu's bit in proc.affinity
+#define CPUBIT(c) (1 << ((c) - cpus))
+
+// Policy every cpu's scheduler() uses to pick from its run queue.
+static int schedpolicy = SCHEDPOLICY;
+
+// Microseconds a process runs before it is preempted for another.
+#define QUANTUM_MIN 100
+#define QUANTUM_MAX 1000000
+static uint quantum = QUANTUM;
+
+// Most a process's tickets are inflated for leaving its quantum early,
+// and the most any process may draw with, so run queue sums fit an int.
+// settickets() refuses more than EFFTICKETS_MAX, so compensation only
+// ever inflates.
+#define COMPENSATE_MAX 100
+#define EFFTICKETS_MAX (0x7FFFFFFF / NPROC)
+
+// Slots in a run queue block of 2^order pages: a pointer and a Fenwick
+// tree entry per slot, plus the tree's unused entry 0.
+#define RQSLOTS(order) \
+  (((PGSIZE << (order)) - sizeof(int)) / (sizeof(struct proc*) + sizeof(int)))
+
+// Order of every cpu's run queue block; -1 before the first process.
+static int rqorder = -1;
+
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void setrunnable(struct proc *p);
+static void rqremove(struct proc *p);
+static int rqreserve(int n);
+static int stealable(struct cpu *c);
+static void rqbalance(struct cpu *c);
+static struct cpu* homecpu(struct proc *p);
+static void cpuidle(struct cpu *c);
+static void compensate(struct proc *p);
+static void rqsettickets(struct proc *p, int tickets);
+static struct tgroup* groupalloc(void);
+static void procabort(struct proc *p);
+static void procadd(struct proc *p, struct proc *parent);
+static void procfree(struct proc *p);
+static void chanremove(struct proc *p);
+static int wakeupn(void *chan, struct mm *mm, int n);
+static void groupjoin(struct proc *p, struct tgroup *g);
+static void groupleave(struct proc *p);
 
 void
 pinit(void)
 {
   initlock(&ptable.lock, "ptable");
+  kcache_init(&ptable.proccache, "proc", sizeof(struct proc));
+  kcache_init(&ptable.groupcache, "tgroup", sizeof(struct tgroup));
 }
 
 // Must be called with interrupts disabled
@@ -77,10 +182,15 @@ myproc(void) {
 }
 
 //PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
-// If found, change state to EMBRYO and initialize
-// state required to run in the kernel.
+// Allocate a proc from the process cache, unless there
+// are NPROC already. If one can be had, change state to
+// EMBRYO and initialize state required to run in the kernel.
 // Otherwise return 0.
+/*
+ * @revisions
+ *   GJE p5  - Allocate from proccache instead of the fixed table
+ *           - Grow the run queues to hold one more process
+ */
 static struct proc*
 allocproc(void)
 {
@@ -89,22 +199,27 @@ allocproc(void)
 
   acquire(&ptable.lock);
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
-
-  release(&ptable.lock);
-  return 0;
+  if(ptable.nproc >= NPROC || rqreserve(ptable.nproc + 1) < 0 ||
+     (p = kcache_alloc(&ptable.proccache)) == 0){
+    release(&ptable.lock);
+    return 0;
+  }
 
-found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->allprev = ptable.alltail;
+  if(ptable.alltail)
+    ptable.alltail->allnext = p;
+  else
+    ptable.allproc = p;
+  ptable.alltail = p;
+  ptable.nproc++;
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
-    p->state = UNUSED;
+    procabort(p);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -136,15 +251,18 @@ void
 userinit(void)
 {
   struct proc *p;
+  struct tgroup *g;
+  pde_t *pgdir;
   extern char _binary_initcode_start[], _binary_initcode_size[];
 
   p = allocproc();
   
   initproc = p;
-  if((p->pgdir = setupkvm()) == 0)
+  if((pgdir = setupkvm()) == 0)
+    panic("userinit: out of memory?");
+  inituvm(pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+  if((p->mm = mmalloc(pgdir, PGSIZE)) == 0)
     panic("userinit: out of memory?");
-  inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
-  p->sz = PGSIZE;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -163,44 +281,59 @@ userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
-  p->tickets = 1;
+  p->pass = 0;
+  p->affinity = ~0;
+  procadd(p, 0);
+  if((g = groupalloc()) == 0)
+    panic("userinit: out of memory?");
+  g->tickets = 1;
+  groupjoin(p, g);
+  setrunnable(p);
 
   release(&ptable.lock);
 }
 
 // Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Return the old size on success, -1 on failure.
 /*
  * @revisions
  *   GJE p4b - Increase size of all threads sharing address space when 
  *             increasing one
+ *   GJE p5  - Walk the thread list instead of the process table
+ *           - Grow the shared struct mm under its own lock, and return
+ *             the old size so concurrent sbrk()s get distinct memory
+ *           - Shoot down other cpus' TLBs when shrinking, before the
+ *             pages are freed
+ *           - Growing only reserves address space
  */
 int
 growproc(int n)
 {
-	uint sz;
+	uint sz, oldsz;
   	struct proc *curproc = myproc();
- 	struct proc *p;
+	struct mm *mm = curproc->mm;
 
-  	sz = curproc->sz;
+	acquiresleep(&mm->lock);
+  	sz = oldsz = mm->sz;
   	if(n > 0){
-  	  if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+  	  // Only reserve the address space; uvmfault() allocates pages
+  	  // as they're first touched.
+  	  if(sz + n >= KERNBASE || sz + n < sz){
+  	    releasesleep(&mm->lock);
   	    return -1;
+  	  }
+  	  sz += n;
   	} else if(n < 0){
-  	  if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+  	  // Other threads' cpus must be flushed before the pages go.
+  	  if((sz = uvmshrink(mm, sz, sz + n)) == 0){
+  	    releasesleep(&mm->lock);
   	    return -1;
+  	  }
   	}
-	curproc->sz = sz;
-  	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-  	{
-  		if (p->pgdir == curproc->pgdir)
-  	  	{
-  	  		p->sz = sz;
-  	  	}
-  	}
+	mm->sz = sz;
+	releasesleep(&mm->lock);
   	switchuvm(curproc);
-  	return 0;
+  	return oldsz;
 }
 
 // Create a new process copying p as the parent.
@@ -209,31 +342,49 @@ growproc(int n)
 /*
  * @revisions
  *   GJE p2b - set ticket count of child process equal to parent
+ *   GJE p5  - fund the child with the tickets of the parent's group
+ *           - share the parent's pages copy-on-write
  */
 int
 fork(void)
 {
   int i, pid;
   struct proc *np;
+  struct tgroup *g;
+  pde_t *pgdir;
   struct proc *curproc = myproc();
+  struct mm *mm = curproc->mm;
 
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
+  if((g = groupalloc()) == 0){
+    procabort(np);
+    return -1;
+  }
 
   // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+  acquiresleep(&mm->lock);
+  if((pgdir = copyuvm(mm->pgdir, mm->sz)) == 0 ||
+     (np->mm = mmalloc(pgdir, mm->sz)) == 0){
+    releasesleep(&mm->lock);
+    if(pgdir)
+      freevm(pgdir);
+    kcache_free(&ptable.groupcache, g);
+    procabort(np);
     return -1;
   }
-  np->sz = curproc->sz;
-  np->parent = curproc;
+  // Our writable pages just became read-only for threads on other cpus.
+  tlbflush(mm);
+  releasesleep(&mm->lock);
   *np->tf = *curproc->tf;
-  np->tickets = curproc->tickets;
+  np->tls = curproc->tls;
+  np->pass = curproc->pass;
+  np->affinity = curproc->affinity;
   np->ticks = 0;
+  np->migrations = 0;
+  np->utime = np->stime = np->wtime = 0;
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
@@ -249,7 +400,10 @@ fork(void)
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  procadd(np, curproc);
+  g->tickets = curproc->group->tickets;
+  groupjoin(np, g);
+  setrunnable(np);
 
   release(&ptable.lock);
 
@@ -259,6 +413,10 @@ fork(void)
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() or join() to find out it exited.
+/*
+ * @revisions
+ *   GJE p5  - Hand the child list to init instead of scanning the table
+ */
 void
 exit(void)
 {
@@ -288,14 +446,18 @@ exit(void)
   wakeup1(curproc->parent);
 
   // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
-      p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
-    }
+  while((p = curproc->children) != 0){
+    curproc->children = p->sibling;
+    p->parent = initproc;
+    p->sibling = initproc->children;
+    initproc->children = p;
+    if(p->state == ZOMBIE)
+      wakeup1(initproc);
   }
 
+  // Hand our tickets back to the threads still running.
+  groupleave(curproc);
+
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
   sched();
@@ -307,6 +469,8 @@ exit(void)
 /*
  * @revisions
  *   GJE p4b - Only wait for processes with separate address space.
+ *   GJE p5  - Scan only our own children
+ *           - The address space goes with the last reference to it
  */
 int
 wait(void)
@@ -317,23 +481,16 @@ wait(void)
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc || p->pgdir == curproc->pgdir)
+    for(p = curproc->children; p != 0; p = p->sibling){
+      if(p->mm == curproc->mm)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        procfree(p);
         release(&ptable.lock);
         return pid;
       }
@@ -357,11 +514,18 @@ wait(void)
  * @param arg2 Second argument passed to fcn
  * @param stack User stack for the new process.
  *              One page in size and page aligned.
+ * @param tls Thread-local storage; the new thread's %gs segment starts
+ *            here. 0 for none.
  * @returns the pid of the newly created thread if successful, -1 otherwise
  * @revisions
  *   GJE p4b - Created
+ *   GJE p5  - Split the group's tickets with the new thread
+ *           - Give back the process if the stack can't be set up
+ *           - Install tls as the thread's %gs segment
+ *           - Give the stack its own copy if it's shared copy-on-write
  */
-int clone(void (*fcn)(void*, void*), void* arg1, void* arg2, void* stack)
+int clone(void (*fcn)(void*, void*), void* arg1, void* arg2, void* stack,
+		  void* tls)
 {
 	int i;
   	int pid;
@@ -381,25 +545,29 @@ int clone(void (*fcn)(void*, void*), void* arg1, void* arg2, void* stack)
   	ustack[2] = (uint)arg2;
 
   	sp -= sizeof(ustack);
-  	if (copyout(curproc->pgdir, sp, ustack, sizeof(ustack)) < 0)
+  	if (uvmcopyout(curproc->mm, sp, ustack, sizeof(ustack)) < 0)
   	{
+		procabort(np);
 		return -1;
 	}
 
   	// point to SAME address space as current porc
-  	np->pgdir = curproc->pgdir;
+  	np->mm = mmdup(curproc->mm);
 
-  	np->sz = curproc->sz;
-  	np->parent = curproc;
   	*np->tf = *curproc->tf;
-  	np->tickets = curproc->tickets;
+  	np->pass = curproc->pass;
+  	np->affinity = curproc->affinity;
   	np->ticks = 0;
+  	np->migrations = 0;
+  	np->utime = np->stime = np->wtime = 0;
 
   	// setup new user stack and registers
 	np->tf->eax = 0; // clear eax so 0 returned to child
   	np->tf->ebp = (uint)stack;
   	np->tf->eip = (uint)fcn;
   	np->tf->esp = sp;
+  	np->tls = (uint)tls;
+  	np->tf->gs = tls ? (SEG_UTLS << 3) | DPL_USER : 0;
 
   	for(i = 0; i < NOFILE; i++)
   	  if(curproc->ofile[i])
@@ -412,7 +580,10 @@ int clone(void (*fcn)(void*, void*), void* arg1, void* arg2, void* stack)
 
   	acquire(&ptable.lock);
 
-  	np->state = RUNNABLE;
+  	// share the tickets of the current process's group
+  	procadd(np, curproc);
+  	groupjoin(np, curproc->group);
+  	setrunnable(np);
 
   	release(&ptable.lock);
 
@@ -426,34 +597,35 @@ int clone(void (*fcn)(void*, void*), void* arg1, void* arg2, void* stack)
  * @returns pid of exited thread if successful, -1 otherwise
  * @revisions
  *   GJE p4b - Created
+ *   GJE p5  - Scan only our own children
+ *           - Store the stack once ptable.lock is dropped, as the page
+ *             may have become copy-on-write while we slept
  */
 int join(void** stack)
 {
   struct proc *p;
   int hasthreads, pid;
+  uint ustack;
   struct proc *curproc = myproc();
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited threads
+    // Scan through our children looking for exited threads
     hasthreads = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc || p->pgdir != curproc->pgdir)
+    for(p = curproc->children; p != 0; p = p->sibling){
+      if(p->mm != curproc->mm)
         continue;
       hasthreads = 1;
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-		// 
-		*stack = (void*)PGROUNDDOWN(p->tf->esp);
-        kfree(p->kstack);
-        p->kstack = 0;
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        ustack = PGROUNDDOWN(p->tf->esp);
+        procfree(p);
         release(&ptable.lock);
+        // A sibling may have forked while we slept, sharing the page
+        // *stack is on copy-on-write.
+        if(uvmcopyout(curproc->mm, (uint)stack, &ustack, sizeof(ustack)) < 0)
+          return -1;
         return pid;
       }
     }
@@ -479,12 +651,22 @@ int join(void** stack)
 /*
  * @revisions
  *   GJE p2b - Implement lottery scheduler
+ *   GJE p5  - Draw only from this cpu's run queue, and don't touch
+ *             ptable.lock while the queue is empty
+ *           - Pick by stride instead when selected with setsched()
+ *           - Pull work from other cpus when idle, and periodically
+ *           - Halt when there is nothing to run or steal
+ *           - Arm the timer for a quantum only if others are waiting
+ *           - Drop compensation tickets once a process runs again
+ *           - Charge the time a process waited in the run queue
+ *           - Count a migration when a process runs on a new cpu
  */
 void
 scheduler(void)
 {
 	struct proc* p;
 	struct cpu *c = mycpu();
+	uint64 now;
 	c->proc = 0;
   
 	for(;;)
@@ -492,17 +674,70 @@ scheduler(void)
 		// Enable interrupts on this processor.
 		sti();
 
-		// Loop over process table looking for process to run.
+		// Nothing queued here or anywhere we could steal from;
+		// don't contend for ptable.lock with cpus doing real work.
+		if (c->rq.nrunnable == 0 && !stealable(c))
+		{
+			cpuidle(c);
+			continue;
+		}
+
+		// Still one lock for every cpu's dispatch: see struct runqueue.
 		acquire(&ptable.lock);
+
+		if (c->rq.nrunnable == 0 || ticks - c->lastbalance >= BALANCE_TICKS)
+		{
+			c->lastbalance = ticks;
+			rqbalance(c);
+		}
 		
-		p = getLotteryWinner();
+		if (schedpolicy == SCHED_STRIDE)
+		{
+			p = getStrideWinner(c);
+		}
+		else
+		{
+			p = getLotteryWinner(c);
+		}
 
 		if (p != 0)
 		{
+			// Advance the stride clock under either policy so a
+			// switch with setsched() starts from sane passes.
+			if ((int)(p->pass - c->rq.pass) > 0)
+			{
+				c->rq.pass = p->pass;
+			}
+			p->pass += p->stride;
+			p->lastrun = ticks;
+
 			// Switch to chosen process.  It is the process's job
 			// to release ptable.lock and then reacquire it
 			// before jumping back to us.
+			rqremove(p);
+			p->efftickets = p->tickets;
 			c->proc = p;
+			if (p->lastcpu != 0 && p->lastcpu != c)
+			{
+				p->migrations++;
+			}
+			p->lastcpu = c;
+
+			// With nothing else queued here there is no one to
+			// preempt p for; only wake up for the next balance.
+			now = rdtsc();
+			p->dispatched = now;
+			p->wtime += now - p->tstamp;
+			p->tstamp = now;
+			if (c->rq.nrunnable > 0)
+			{
+				c->qend = now + (uint64)quantum * tscperus;
+			}
+			else
+			{
+				c->qend = now + (uint64)BALANCE_TICKS * TICKUS * tscperus;
+			}
+			timerset();
 			switchuvm(p);
 			p->state = RUNNING;
 
@@ -522,229 +757,1398 @@ scheduler(void)
 
 /*
  * Picks a lottery schedule winner based on tickets allocated to each process
+ * queued on a cpu. Caller must hold ptable.lock.
+ * @param c The cpu whose run queue holds the lottery
  * @returns Pointer to winning process if sucessful, 0 if unsuccessful
  * @revisions
  *   GJE p2b - Created
+ *   GJE p5  - Draw from the run queue of cpu c instead of the process table
+ *           - Find the winner by descending the Fenwick tree
+ *           - Use the cpu's own generator instead of the shared rand0()
  */
-struct proc* getLotteryWinner(void)
+struct proc* getLotteryWinner(struct cpu* c)
 {
-	struct proc* p;
-	int ticketCount = 0;
+	struct runqueue* rq = &c->rq;
 	int winner;
-	for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-	{
-		if (p->state == RUNNABLE)
-		{
-			ticketCount += p->tickets;
-		}
-	}
+	int pos = 0;
+	int step;
 
-	if (ticketCount == 0)
+	if (rq->tickets == 0)
 	{
 		return 0;
 	}
 
-	winner = rand0() % ticketCount;
+	winner = randnext(&c->rand) % rq->tickets;
 
-	ticketCount = 0;
-	for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+	// Find the slot whose running ticket sum first exceeds winner.
+	for (step = 1; 2 * step <= rq->nrunnable; step *= 2)
+		;
+	for (; step > 0; step /= 2)
 	{
-		if (p->state == RUNNABLE)
+		if (pos + step <= rq->nrunnable && rq->fenwick[pos + step] <= winner)
 		{
-			ticketCount += p->tickets;
-			if (ticketCount > winner)
-			{
-				return p;
-			}
+			pos += step;
+			winner -= rq->fenwick[pos];
 		}
 	}
-	return 0;
+	return rq->proc[pos];
 }
 
-// Enter scheduler.  Must hold only ptable.lock
-// and have changed proc->state. Saves and restores
-// intena because intena is a property of this
-// kernel thread, not this CPU. It should
-// be proc->intena and proc->ncli, but that would
-// break in the few places where a lock is held but
-// there's no process.
-void
-sched(void)
+/*
+ * Picks the queued process with the lowest pass, i.e. the one furthest
+ * behind its share of the cpu. Caller must hold ptable.lock.
+ * @param c The cpu whose run queue to pick from
+ * @returns Pointer to the chosen process, 0 if the queue is empty
+ * @revisions
+ *   GJE p5  - Created
+ */
+struct proc* getStrideWinner(struct cpu* c)
 {
-  int intena;
-  struct proc *p = myproc();
+	struct runqueue* rq = &c->rq;
+	struct proc* winner = 0;
 
-  if(!holding(&ptable.lock))
-    panic("sched ptable.lock");
-  if(mycpu()->ncli != 1)
-    panic("sched locks");
-  if(p->state == RUNNING)
-    panic("sched running");
-  if(readeflags()&FL_IF)
-    panic("sched interruptible");
-  intena = mycpu()->intena;
-  swtch(&p->context, mycpu()->scheduler);
-  mycpu()->intena = intena;
+	// Passes wrap, so compare their difference rather than the values.
+	for (int i = 0; i < rq->nrunnable; i++)
+	{
+		if (winner == 0 || (int)(rq->proc[i]->pass - winner->pass) < 0)
+		{
+			winner = rq->proc[i];
+		}
+	}
+	return winner;
 }
 
-// Give up the CPU for one scheduling round.
-void
-yield(void)
+/*
+ * Adds to the tickets of a run queue slot in the Fenwick tree
+ * @param rq The run queue
+ * @param i Index of the slot in rq->proc
+ * @param delta The number of tickets to add (may be negative)
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void fwadd(struct runqueue* rq, int i, int delta)
 {
-  acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
-  sched();
-  release(&ptable.lock);
+	for (i++; i <= rq->size; i += i & -i)
+	{
+		rq->fenwick[i] += delta;
+	}
+	rq->tickets += delta;
 }
 
-// A fork child's very first scheduling by scheduler()
-// will swtch here.  "Return" to user space.
-void
-forkret(void)
+/*
+ * Adds a process to the run queue of a cpu.
+ * Caller must hold ptable.lock.
+ * @param c The cpu to queue the process on
+ * @param p The process to queue
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void rqadd(struct cpu* c, struct proc* p)
 {
-  static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
-
-  if (first) {
-    // Some initialization functions must be run in the context
-    // of a regular process (e.g., they call sleep), and thus cannot
-    // be run from main().
-    first = 0;
-    iinit(ROOTDEV);
-    initlog(ROOTDEV);
-  }
+	struct runqueue* rq = &c->rq;
 
-  // Return to "caller", actually trapret (see allocproc).
+	if (p->rqcpu != 0 || rq->nrunnable >= rq->size)
+	{
+		panic("rqadd");
+	}
+	// A process that slept doesn't get to bank the time it was away.
+	if ((int)(p->pass - rq->pass) < 0)
+	{
+		p->pass = rq->pass;
+	}
+	p->rqcpu = c;
+	p->rqidx = rq->nrunnable;
+	rq->proc[rq->nrunnable++] = p;
+	fwadd(rq, p->rqidx, p->efftickets);
 }
 
-// Atomically release lock and sleep on chan.
-// Reacquires lock when awakened.
-void
-sleep(void *chan, struct spinlock *lk)
+/*
+ * Removes a process from the run queue that holds it.
+ * The last queued process takes its slot, so removal is O(1).
+ * Caller must hold ptable.lock.
+ * @param p The process to dequeue
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void rqremove(struct proc* p)
 {
-  struct proc *p = myproc();
-  
-  if(p == 0)
-    panic("sleep");
-
-  if(lk == 0)
-    panic("sleep without lk");
-
-  // Must acquire ptable.lock in order to
-  // change p->state and then call sched.
-  // Once we hold ptable.lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup runs with ptable.lock locked),
-  // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
-    acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
-  }
-  // Go to sleep.
-  p->chan = chan;
-  p->state = SLEEPING;
+	struct runqueue* rq;
+	struct proc* last;
 
-  sched();
+	if (p->rqcpu == 0)
+	{
+		panic("rqremove");
+	}
+	rq = &p->rqcpu->rq;
+	last = rq->proc[--rq->nrunnable];
+	fwadd(rq, p->rqidx, -p->efftickets);
+	if (last != p)
+	{
+		fwadd(rq, last->rqidx, -last->efftickets);
+		fwadd(rq, p->rqidx, last->efftickets);
+		rq->proc[p->rqidx] = last;
+		last->rqidx = p->rqidx;
+	}
+	rq->proc[rq->nrunnable] = 0;
+	p->rqcpu = 0;
+}
 
-  // Tidy up.
-  p->chan = 0;
+/*
+ * Moves a run queue into a new, larger block and rebuilds its Fenwick
+ * tree there. The old block is never freed: canpull() reads proc[]
+ * without ptable.lock, and may still be looking at it. Queues grow
+ * only a few times on the way to NPROC, so little is lost.
+ * Caller must hold ptable.lock.
+ * @param rq The run queue
+ * @param block The new block, of 2^order pages
+ * @param order The order of the block
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void rqmove(struct runqueue* rq, char* block, int order)
+{
+	struct proc** proc = (struct proc**)block;
+	int size = RQSLOTS(order);
+	int* fenwick = (int*)(proc + size);
+	int i;
+	int j;
 
-  // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    acquire(lk);
-  }
+	memset(block, 0, PGSIZE << order);
+	for (i = 0; i < rq->nrunnable; i++)
+	{
+		proc[i] = rq->proc[i];
+	}
+	// Each entry, once complete, adds itself to its parent.
+	for (i = 1; i <= size; i++)
+	{
+		if (i <= rq->nrunnable)
+		{
+			fenwick[i] += proc[i - 1]->efftickets;
+		}
+		if ((j = i + (i & -i)) <= size)
+		{
+			fenwick[j] += fenwick[i];
+		}
+	}
+	rq->proc = proc;
+	rq->fenwick = fenwick;
+	// Publish the bigger block before its size; see canpull().
+	__sync_synchronize();
+	rq->size = size;
 }
 
-//PAGEBREAK!
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
-static void
-wakeup1(void *chan)
+/*
+ * Makes every cpu's run queue big enough to hold n processes, so a
+ * cpu only pays for as many slots as there have been processes at
+ * once, not NPROC. Queues never shrink. Caller must hold ptable.lock.
+ * @param n The number of processes
+ * @returns 0 on success, -1 if out of memory
+ * @revisions
+ *   GJE p5  - Created
+ */
+static int rqreserve(int n)
 {
-  struct proc *p;
+	char* blocks[NCPU];
+	int order = rqorder < 0 ? 0 : rqorder;
+	int i;
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+	if (rqorder >= 0 && RQSLOTS(rqorder) >= n)
+	{
+		return 0;
+	}
+	while (RQSLOTS(order) < n)
+	{
+		order++;
+	}
+	// Get every block first, so a failure leaves the queues as they were.
+	for (i = 0; i < ncpu; i++)
+	{
+		if ((blocks[i] = kallocpages(order)) == 0)
+		{
+			while (--i >= 0)
+			{
+				kfreepages(blocks[i], order);
+			}
+			return -1;
+		}
+	}
+	for (i = 0; i < ncpu; i++)
+	{
+		rqmove(&cpus[i].rq, blocks[i], order);
+	}
+	rqorder = order;
+	return 0;
 }
 
-// Wake up all processes sleeping on chan.
-void
-wakeup(void *chan)
+/*
+ * Changes the ticket count (and so the stride) of a process, keeping
+ * the run queue holding it (if any) consistent. Any compensation
+ * tickets are dropped.
+ * Caller must hold ptable.lock.
+ * @param p The process
+ * @param tickets The new number of tickets
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void rqsettickets(struct proc* p, int tickets)
 {
-  acquire(&ptable.lock);
-  wakeup1(chan);
-  release(&ptable.lock);
+	if (p->rqcpu != 0)
+	{
+		fwadd(&p->rqcpu->rq, p->rqidx, tickets - p->efftickets);
+	}
+	p->tickets = tickets;
+	p->efftickets = tickets;
+	p->stride = STRIDE1 / tickets;
+	if (p->stride == 0)
+	{
+		p->stride = 1;
+	}
 }
 
-// Kill the process with the given pid.
-// Process won't exit until it returns
-// to user space (see trap in trap.c).
-int
-kill(int pid)
+/*
+ * Makes a new process findable by pid and links it into its parent's
+ * list of children. Caller must hold ptable.lock.
+ * @param p The new process
+ * @param parent Its parent, or 0 for the first process
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void procadd(struct proc* p, struct proc* parent)
 {
-  struct proc *p;
-
-  acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
-  }
-  release(&ptable.lock);
-  return -1;
+	struct proc** bucket = &ptable.pidhash[PIDHASH(p->pid)];
+
+	p->pidnext = *bucket;
+	*bucket = p;
+	p->children = 0;
+	p->parent = parent;
+	p->sibling = 0;
+	if (parent != 0)
+	{
+		p->sibling = parent->children;
+		parent->children = p;
+	}
 }
 
 /*
- * Report ticket info for all running processes
- * @param pstat Pointer to pstat struct to file data for running processes
- * @returns 0 if sucessfull, -1 otherwise
+ * Unlinks a process from allproc and returns it to proccache.
+ * Caller must hold ptable.lock.
+ * @param p The process, which must be in no other list
  * @revisions
- *   GJE p2b - Created
+ *   GJE p5  - Created
  */
-int getpinfo(struct pstat* pstat)
+static void procdealloc(struct proc* p)
 {
-	struct proc* p;
-    for(int i=0; i < NPROC; i++)
+	if (p->allprev)
 	{
-		p = &ptable.proc[i];
-		if (p->state == UNUSED)
-		{
-			pstat->inuse[i] = 0;
-		}
-		else
-		{
-			pstat->inuse[i] = 1;
-			pstat->tickets[i] = p->tickets;
-			pstat->pid[i] = p->pid;
-			pstat->ticks[i] = p->ticks;
-		}
+		p->allprev->allnext = p->allnext;
 	}
-
-	return 0;
+	else
+	{
+		ptable.allproc = p->allnext;
+	}
+	if (p->allnext)
+	{
+		p->allnext->allprev = p->allprev;
+	}
+	else
+	{
+		ptable.alltail = p->allprev;
+	}
+	ptable.nproc--;
+	kcache_free(&ptable.proccache, p);
 }
 
-
 /*
- * Sets the number of tickets for the calling process
- * @param number The number of tickets to set for the process
+ * Undoes allocproc() for a process that fork() or clone() could not
+ * finish setting up, and so was never made visible.
+ * @param p The EMBRYO process
  * @revisions
- *   GJE p2b - Created
+ *   GJE p5  - Created
+ *           - Drop its address space, if it got one
  */
-int settickets(int number)
+static void procabort(struct proc* p)
 {
-	if (number <= 0)
+	if (p->mm)
 	{
-		return -1;
+		mmput(p->mm);
+		p->mm = 0;
+	}
+	if (p->kstack)
+	{
+		kfree(p->kstack);
+		p->kstack = 0;
+	}
+	acquire(&ptable.lock);
+	procdealloc(p);
+	release(&ptable.lock);
+}
+
+/*
+ * Frees a reaped ZOMBIE: unlinks it from the pid hash and its parent's
+ * children and releases its kernel stack, its reference to its address
+ * space and the proc itself. Caller must hold ptable.lock.
+ * @param p The process
+ * @revisions
+ *   GJE p5  - Created from wait() and join()
+ *           - Return the proc to proccache
+ *           - Drop the process's reference to its struct mm
+ */
+static void procfree(struct proc* p)
+{
+	struct proc** pp;
+
+	for (pp = &ptable.pidhash[PIDHASH(p->pid)]; *pp != p; pp = &(*pp)->pidnext)
+		;
+	*pp = p->pidnext;
+	for (pp = &p->parent->children; *pp != p; pp = &(*pp)->sibling)
+		;
+	*pp = p->sibling;
+
+	kfree(p->kstack);
+	p->kstack = 0;
+	mmput(p->mm);
+	p->mm = 0;
+	p->state = UNUSED;
+	procdealloc(p);
+}
+
+/*
+ * Allocates an empty ticket group; the caller funds it and joins it
+ * under ptable.lock.
+ * @returns the group, 0 if out of memory
+ * @revisions
+ *   GJE p5  - Created
+ *           - Allocate from groupcache
+ */
+static struct tgroup* groupalloc(void)
+{
+	return kcache_alloc(&ptable.groupcache);
+}
+
+/*
+ * Splits a group's funding evenly among its threads, giving the
+ * remainder out one ticket at a time. Every thread gets at least one
+ * ticket, even if the group has fewer tickets than threads.
+ * Caller must hold ptable.lock.
+ * @param g The group
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void groupsplit(struct tgroup* g)
+{
+	struct proc* p;
+	int share;
+	int extra;
+	int tickets;
+
+	if (g->nthreads == 0)
+	{
+		return;
+	}
+	share = g->tickets / g->nthreads;
+	extra = g->tickets % g->nthreads;
+	for (p = g->threads; p != 0; p = p->threadnext)
+	{
+		tickets = share;
+		if (extra > 0)
+		{
+			tickets++;
+			extra--;
+		}
+		rqsettickets(p, tickets > 0 ? tickets : 1);
+	}
+}
+
+/*
+ * Adds a process to a ticket group and resplits the group's funding.
+ * Caller must hold ptable.lock.
+ * @param p The process, which must not be in a group
+ * @param g The group to join
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void groupjoin(struct proc* p, struct tgroup* g)
+{
+	p->group = g;
+	p->threadnext = g->threads;
+	g->threads = p;
+	g->nthreads++;
+	groupsplit(g);
+}
+
+/*
+ * Removes an exiting process from its ticket group, handing its
+ * share to the threads left. The last one out frees the group.
+ * Caller must hold ptable.lock.
+ * @param p The process
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void groupleave(struct proc* p)
+{
+	struct tgroup* g = p->group;
+	struct proc** pp;
+
+	for (pp = &g->threads; *pp != p; pp = &(*pp)->threadnext)
+		;
+	*pp = p->threadnext;
+	p->threadnext = 0;
+	p->group = 0;
+	g->nthreads--;
+	if (g->nthreads == 0)
+	{
+		kcache_free(&ptable.groupcache, g);
+		return;
+	}
+	groupsplit(g);
+}
+
+/*
+ * Gives a thread exec'ing out of an address space other threads share
+ * a ticket group of its own, funded the way fork() funds a child, so
+ * the new program no longer splits its tickets with the old one's
+ * threads. A thread alone in its group keeps it.
+ * @returns 0 on success, -1 if out of memory
+ * @revisions
+ *   GJE p5  - Created
+ */
+int groupexec(void)
+{
+	struct proc* p = myproc();
+	struct tgroup* g;
+
+	if ((g = groupalloc()) == 0)
+	{
+		return -1;
+	}
+	acquire(&ptable.lock);
+	if (p->group->nthreads == 1)
+	{
+		kcache_free(&ptable.groupcache, g);
+		release(&ptable.lock);
+		return 0;
+	}
+	g->tickets = p->group->tickets;
+	groupleave(p);
+	groupjoin(p, g);
+	release(&ptable.lock);
+	return 0;
+}
+
+/*
+ * Reports whether a cpu has queued work it can't get to right away,
+ * which c is allowed to run. A lone queued process on an idle cpu
+ * will run there soon. Reads o's queue without ptable.lock, so it is
+ * only a hint. The reads are safe because procs are never unmapped
+ * and a queue's old blocks are never freed (see rqmove()). Reading
+ * size before proc keeps the index inside whichever block is seen.
+ * @param o The cpu to check
+ * @param c The cpu that would take the work
+ * @returns 1 if c may take from o's queue, 0 otherwise
+ * @revisions
+ *   GJE p5  - Created
+ *           - Only count processes whose affinity allows c
+ *           - Bound the scan by the size of the block read
+ */
+static int canpull(struct cpu* o, struct cpu* c)
+{
+	struct proc** procs;
+	struct proc* p;
+	int n = o->rq.nrunnable;
+	int size = o->rq.size;
+
+	if (n == 0 || (n == 1 && o->proc == 0))
+	{
+		return 0;
+	}
+	// Pairs with the barrier in rqmove().
+	__sync_synchronize();
+	procs = o->rq.proc;
+	for (int i = 0; i < n && i < size; i++)
+	{
+		p = procs[i];
+		if (p != 0 && (p->affinity & CPUBIT(c)))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Reports whether another cpu has queued work that c could take.
+ * Reads other cpus' queues without ptable.lock, so it is only a hint.
+ * @param c The cpu looking for work
+ * @returns 1 if worth taking ptable.lock to steal, 0 otherwise
+ * @revisions
+ *   GJE p5  - Created
+ */
+static int stealable(struct cpu* c)
+{
+	struct cpu* o;
+
+	for (o = cpus; o < cpus + ncpu; o++)
+	{
+		if (o != c && canpull(o, c))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Ticket load of a cpu: its queued tickets plus those of the process
+ * it is running. Caller must hold ptable.lock.
+ * @revisions
+ *   GJE p5  - Created
+ */
+static int cpuload(struct cpu* c)
+{
+	int load = c->rq.tickets;
+
+	if (c->proc != 0)
+	{
+		load += c->proc->efftickets;
+	}
+	return load;
+}
+
+/*
+ * Moves a queued process from the cpu with the most tickets to c, if
+ * that narrows the gap between them. Of the processes that fit, takes
+ * the one that ran least recently, as it is least likely to still have
+ * a warm cache on the other cpu. Caller must hold ptable.lock.
+ * @param c The cpu pulling work
+ * @revisions
+ *   GJE p5  - Created
+ *           - Leave processes whose affinity excludes c; scheduler()
+ *             counts the migration when the process runs
+ */
+static void rqbalance(struct cpu* c)
+{
+	struct cpu* busiest = 0;
+	struct cpu* o;
+	struct proc* p;
+	struct proc* victim = 0;
+	int load = cpuload(c);
+	int maxload = load;
+	int gap;
+
+	for (o = cpus; o < cpus + ncpu; o++)
+	{
+		if (o != c && canpull(o, c) && cpuload(o) > maxload)
+		{
+			maxload = cpuload(o);
+			busiest = o;
+		}
+	}
+	if (busiest == 0)
+	{
+		return;
+	}
+
+	// Moving p helps only if it leaves c with less load than busiest had.
+	gap = maxload - load;
+	for (int i = 0; i < busiest->rq.nrunnable; i++)
+	{
+		p = busiest->rq.proc[i];
+		if (p->efftickets < gap && (p->affinity & CPUBIT(c))
+			&& (victim == 0 || (int)(p->lastrun - victim->lastrun) < 0))
+		{
+			victim = p;
+		}
+	}
+	if (victim == 0)
+	{
+		return;
+	}
+
+	// Keep its place relative to the new queue's stride clock.
+	rqremove(victim);
+	victim->pass = victim->pass - busiest->rq.pass + c->rq.pass;
+	rqadd(c, victim);
+}
+
+/*
+ * Picks the cpu a process should queue on: the one that last ran it,
+ * whose cache may still hold its working set, if its affinity allows;
+ * else this cpu if allowed; else the least loaded cpu that is.
+ * Caller must hold ptable.lock.
+ * @param p The process
+ * @returns the cpu
+ * @revisions
+ *   GJE p5  - Created
+ */
+static struct cpu* homecpu(struct proc* p)
+{
+	struct cpu* c = mycpu();
+	struct cpu* o;
+	struct cpu* best = 0;
+
+	if (p->lastcpu != 0 && (p->affinity & CPUBIT(p->lastcpu)))
+	{
+		return p->lastcpu;
+	}
+	if (p->affinity & CPUBIT(c))
+	{
+		return c;
+	}
+	// setaffinity() never leaves a process with no cpu to run on.
+	for (o = cpus; o < cpus + ncpu; o++)
+	{
+		if ((p->affinity & CPUBIT(o))
+			&& (best == 0 || cpuload(o) < cpuload(best)))
+		{
+			best = o;
+		}
+	}
+	return best;
+}
+
+/*
+ * Halts the cpu until an interrupt arrives, unless work shows up first.
+ * Spare time first goes to zeroing pages for kalloc_zeroed().
+ * Called from scheduler() with interrupts enabled and no locks held.
+ * @param c The current cpu
+ * @revisions
+ *   GJE p5  - Created
+ *           - Zero pages before halting
+ */
+static void cpuidle(struct cpu* c)
+{
+	// A page at a time, checking for work queued here in between
+	while (c->rq.nrunnable == 0 && kzerofill())
+		;
+
+	cli();
+	c->idle = 1;
+	// Pairs with the barrier in setrunnable(): either the waker sees
+	// us idle and sends an IPI, or we see its queued process here.
+	__sync_synchronize();
+	if (c->rq.nrunnable == 0 && !stealable(c))
+	{
+		timerset();
+		stihlt();
+	}
+	c->idle = 0;
+	sti();
+}
+
+/*
+ * Marks a process RUNNABLE and queues it on its home cpu, the one that
+ * last ran it, so it finds its cache warm. Only when home is busy and
+ * a cpu the process may use is halted is it handed to that cpu
+ * instead, which is woken with an IPI. Caller must hold ptable.lock.
+ * @param p The process to make runnable
+ * @revisions
+ *   GJE p5  - Created
+ *           - Hand the process to an idle cpu if this one is busy
+ *           - Shorten the running process's timer when p has to wait
+ *           - Queue on the cpu that last ran p rather than this one,
+ *             and only on cpus its affinity allows
+ */
+static void setrunnable(struct proc* p)
+{
+	struct cpu* c = mycpu();
+	struct cpu* home = homecpu(p);
+	struct cpu* o;
+	uint64 end;
+
+	p->state = RUNNABLE;
+	p->tstamp = rdtsc();
+	if (home->proc != 0)
+	{
+		for (o = cpus; o < cpus + ncpu; o++)
+		{
+			if (o->idle && (p->affinity & CPUBIT(o)))
+			{
+				// Claim it so the next waker picks another idle cpu.
+				o->idle = 0;
+				rqadd(o, p);
+				lapicipi(o->apicid, T_IRQ0 + IRQ_RESCHED);
+				return;
+			}
+		}
+	}
+	rqadd(home, p);
+	if (home->proc == 0)
+	{
+		// Pairs with the barrier in cpuidle(): either home sees p
+		// queued, or we see it halted and wake it.
+		__sync_synchronize();
+		if (home != c && home->idle)
+		{
+			home->idle = 0;
+			lapicipi(home->apicid, T_IRQ0 + IRQ_RESCHED);
+		}
+		return;
+	}
+
+	// The running process may be on a long, uncontended timer;
+	// give it at most one more quantum now that p is waiting.
+	end = rdtsc() + (uint64)quantum * tscperus;
+	if (home->qend > end)
+	{
+		home->qend = end;
+		if (home == c)
+		{
+			timerset();
+		}
+		else
+		{
+			lapicipi(home->apicid, T_IRQ0 + IRQ_RESCHED);
+		}
+	}
+
+	// A cpu may have gone idle since we looked. Pairs with the barrier
+	// in cpuidle(): either it sees p queued and steals it, or we see
+	// it idle and wake it up to do so.
+	__sync_synchronize();
+	for (o = cpus; o < cpus + ncpu; o++)
+	{
+		if (o->idle && (p->affinity & CPUBIT(o)))
+		{
+			o->idle = 0;
+			lapicipi(o->apicid, T_IRQ0 + IRQ_RESCHED);
+			return;
+		}
+	}
+}
+
+/*
+ * Sets the tickets a process draws with until it next runs. One that
+ * gives up the cpu after using only a fraction f of its quantum has
+ * its tickets inflated by 1/f, so processes that block early still
+ * get their share of the cpu (compensation tickets, Waldspurger and
+ * Weihl). Caller must hold ptable.lock, and p must not be queued.
+ * @param p The process leaving the cpu
+ * @revisions
+ *   GJE p5  - Created
+ *           - Divide the whole 64-bit cycle count
+ *           - Never leave a process fewer tickets than its own
+ */
+static void compensate(struct proc* p)
+{
+	uint64 used = rdtsc() - p->dispatched;
+	uint64 eff;
+	uint us;
+	uint scale;
+
+	p->efftickets = p->tickets;
+	if (used >= (uint64)quantum * tscperus)
+	{
+		return;
+	}
+
+	// 1/f in 256ths, capped for processes that barely ran.
+	us = udiv64(used, tscperus);
+	if (us * COMPENSATE_MAX < quantum)
+	{
+		scale = COMPENSATE_MAX << 8;
+	}
+	else
+	{
+		scale = (quantum << 8) / us;
+	}
+	eff = ((uint64)p->tickets * scale) >> 8;
+	if (eff > EFFTICKETS_MAX)
+	{
+		eff = EFFTICKETS_MAX;
+	}
+	// Never draw with fewer than the process's own tickets.
+	if (eff > p->tickets)
+	{
+		p->efftickets = eff;
+	}
+}
+
+/*
+ * Charges the cycles since the running process's time was last charged
+ * to its user or its system time. Called by trap() on entry from and
+ * return to user mode.
+ * @param user 1 to charge user time, 0 to charge system time
+ * @revisions
+ *   GJE p5  - Created
+ */
+void cpuacct(int user)
+{
+	struct proc* p;
+	uint64 now;
+
+	// System calls arrive with interrupts on; don't let a preemption
+	// charge the same cycles in sched().
+	pushcli();
+	p = mycpu()->proc;
+	now = rdtsc();
+	if (p != 0)
+	{
+		if (user)
+		{
+			p->utime += now - p->tstamp;
+		}
+		else
+		{
+			p->stime += now - p->tstamp;
+		}
+		p->tstamp = now;
+	}
+	popcli();
+}
+
+/*
+ * Arms this cpu's one-shot lapic timer for the next event it needs:
+ * the end of the running process's quantum and, on cpu 0, which
+ * keeps ticks, the next clock tick. Other cpus take no timer
+ * interrupts while idle. Must be called with interrupts disabled.
+ * @revisions
+ *   GJE p5  - Created
+ */
+void timerset(void)
+{
+	struct cpu* c = mycpu();
+	uint64 now = rdtsc();
+	uint64 next = 0;
+	uint64 delta;
+
+	if (c->proc != 0)
+	{
+		next = c->qend;
+	}
+	if (c == &cpus[0] && (next == 0 || nexttick < next))
+	{
+		next = nexttick;
+	}
+	if (next == 0)
+	{
+		lapicarm(0);
+		return;
+	}
+
+	delta = next > now ? next - now : 0;
+	if (delta > 0xFFFFFFFF)
+	{
+		delta = 0xFFFFFFFF;
+	}
+	lapicarm((uint)delta / tscperus + 1);
+}
+
+// Enter scheduler.  Must hold only ptable.lock
+// and have changed proc->state. Saves and restores
+// intena because intena is a property of this
+// kernel thread, not this CPU. It should
+// be proc->intena and proc->ncli, but that would
+// break in the few places where a lock is held but
+// there's no process.
+void
+sched(void)
+{
+  int intena;
+  struct proc *p = myproc();
+  uint64 now;
+
+  if(!holding(&ptable.lock))
+    panic("sched ptable.lock");
+  if(mycpu()->ncli != 1)
+    panic("sched locks");
+  if(p->state == RUNNING)
+    panic("sched running");
+  if(readeflags()&FL_IF)
+    panic("sched interruptible");
+
+  // Charge the kernel time up to here; if p is RUNNABLE (yield),
+  // its wait for a cpu starts now too.
+  now = rdtsc();
+  p->stime += now - p->tstamp;
+  p->tstamp = now;
+
+  intena = mycpu()->intena;
+  swtch(&p->context, mycpu()->scheduler);
+  mycpu()->intena = intena;
+}
+
+// Give up the CPU for one scheduling round.
+/*
+ * @revisions
+ *   GJE p5  - Requeue on a cpu the process's affinity allows
+ */
+void
+yield(void)
+{
+  struct proc *p = myproc();
+  struct cpu *home;
+
+  acquire(&ptable.lock);  //DOC: yieldlock
+  p->state = RUNNABLE;
+  compensate(p);
+  // Stay here unless setaffinity() has ruled this cpu out.
+  home = homecpu(p);
+  rqadd(home, p);
+  if(home->idle){
+    home->idle = 0;
+    lapicipi(home->apicid, T_IRQ0 + IRQ_RESCHED);
+  }
+  sched();
+  release(&ptable.lock);
+}
+
+// A fork child's very first scheduling by scheduler()
+// will swtch here.  "Return" to user space.
+void
+forkret(void)
+{
+  static int first = 1;
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+
+  if (first) {
+    // Some initialization functions must be run in the context
+    // of a regular process (e.g., they call sleep), and thus cannot
+    // be run from main().
+    first = 0;
+    iinit(ROOTDEV);
+    initlog(ROOTDEV);
+  }
+
+  // Return to "caller", actually trapret (see allocproc).
+}
+
+// Atomically release lock and sleep on chan.
+// Reacquires lock when awakened.
+void
+sleep(void *chan, struct spinlock *lk)
+{
+  struct proc *p = myproc();
+  
+  if(p == 0)
+    panic("sleep");
+
+  if(lk == 0)
+    panic("sleep without lk");
+
+  // Must acquire ptable.lock in order to
+  // change p->state and then call sched.
+  // Once we hold ptable.lock, we can be
+  // guaranteed that we won't miss any wakeup
+  // (wakeup runs with ptable.lock locked),
+  // so it's okay to release lk.
+  if(lk != &ptable.lock){  //DOC: sleeplock0
+    acquire(&ptable.lock);  //DOC: sleeplock1
+    release(lk);
+  }
+  // Go to sleep.
+  p->chan = chan;
+  p->channext = ptable.chanhash[CHANHASH(chan)];
+  ptable.chanhash[CHANHASH(chan)] = p;
+  p->state = SLEEPING;
+  compensate(p);
+
+  sched();
+
+  // Tidy up.
+  p->chan = 0;
+
+  // Reacquire original lock.
+  if(lk != &ptable.lock){  //DOC: sleeplock2
+    release(&ptable.lock);
+    acquire(lk);
+  }
+}
+
+//PAGEBREAK!
+// Wake up all processes sleeping on chan.
+// The ptable lock must be held.
+/*
+ * @revisions
+ *   GJE p5  - Look only at the sleepers hashed with chan
+ */
+static void
+wakeup1(void *chan)
+{
+  wakeupn(chan, 0, NPROC);
+}
+
+/*
+ * Wakes up at most n processes sleeping on chan, the most recent
+ * sleepers first. Caller must hold ptable.lock.
+ * @param chan The wait channel
+ * @param mm Wake only processes in this address space; 0 for any
+ * @param n The most processes to wake
+ * @returns the number of processes woken
+ * @revisions
+ *   GJE p5  - Created from wakeup1()
+ *           - Filter by address space, for futexes
+ */
+static int wakeupn(void* chan, struct mm* mm, int n)
+{
+	struct proc** pp;
+	struct proc* p;
+	int woken = 0;
+
+	ptable.wakeups++;
+	pp = &ptable.chanhash[CHANHASH(chan)];
+	while ((p = *pp) != 0 && woken < n)
+	{
+		if (p->chan == chan && (mm == 0 || p->mm == mm))
+		{
+			*pp = p->channext;
+			p->channext = 0;
+			woken++;
+			setrunnable(p);
+		}
+		else
+		{
+			pp = &p->channext;
+		}
+	}
+	ptable.woken += woken;
+	return woken;
+}
+
+/*
+ * Takes a SLEEPING process off its wait channel's bucket, so it can be
+ * made RUNNABLE by something other than wakeup1().
+ * Caller must hold ptable.lock.
+ * @param p The sleeping process
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void chanremove(struct proc* p)
+{
+	struct proc** pp;
+
+	for (pp = &ptable.chanhash[CHANHASH(p->chan)]; *pp != p; pp = &(*pp)->channext)
+		;
+	*pp = p->channext;
+	p->channext = 0;
+}
+
+// Wake up all processes sleeping on chan.
+void
+wakeup(void *chan)
+{
+  acquire(&ptable.lock);
+  wakeup1(chan);
+  release(&ptable.lock);
+}
+
+// Kill the process with the given pid.
+// Process won't exit until it returns
+// to user space (see trap in trap.c).
+int
+kill(int pid)
+{
+  struct proc *p;
+
+  acquire(&ptable.lock);
+  for(p = ptable.pidhash[PIDHASH(pid)]; p != 0; p = p->pidnext){
+    if(p->pid == pid){
+      p->killed = 1;
+      // Wake process from sleep if necessary.
+      if(p->state == SLEEPING){
+        chanremove(p);
+        setrunnable(p);
+      }
+      release(&ptable.lock);
+      return 0;
+    }
+  }
+  release(&ptable.lock);
+  return -1;
+}
+
+/*
+ * Finds the kernel address of a futex word, to read it through.
+ * Waiters sleep on the user address itself, which can't collide with
+ * a kernel wait channel, and are woken only from their own address
+ * space: the page under the word changes when copy-on-write breaks.
+ * Caller must hold ptable.lock.
+ * @param p The process whose address space addr is in
+ * @param addr User address of the futex word
+ * @returns the kernel address, 0 if addr is not a mapped, aligned int
+ * @revisions
+ *   GJE p5  - Created
+ *           - Only used to read the word; no longer the wait channel
+ */
+static int* futexword(struct proc* p, int* addr)
+{
+	char* page;
+
+	if ((uint)addr % sizeof(int) != 0 || (uint)addr >= p->mm->sz)
+	{
+		return 0;
+	}
+	if ((page = uva2ka(p->mm->pgdir, (char*)addr)) == 0)
+	{
+		return 0;
+	}
+	return (int*)(page + ((uint)addr & (PGSIZE - 1)));
+}
+
+/*
+ * Sleeps until futex_wake() on addr, unless the word at addr no longer
+ * holds expected. futex_wake() takes ptable.lock as well, so a wake
+ * after the caller last looked at the word can't be lost.
+ * @param addr User address of the futex word
+ * @param expected The value the caller saw at addr
+ * @returns 0 once woken, -1 if *addr != expected, addr is bad, or killed
+ * @revisions
+ *   GJE p5  - Created
+ *           - Key waiters by user address and address space
+ */
+int futex_wait(int* addr, int expected)
+{
+	struct proc* p = myproc();
+	int* word;
+
+	acquire(&ptable.lock);
+	if ((word = futexword(p, addr)) == 0 || *word != expected || p->killed)
+	{
+		release(&ptable.lock);
+		return -1;
+	}
+	sleep(addr, &ptable.lock);
+	release(&ptable.lock);
+	return p->killed ? -1 : 0;
+}
+
+/*
+ * Wakes processes sleeping in futex_wait() on addr
+ * @param addr User address of the futex word
+ * @param n The most processes to wake
+ * @returns the number of processes woken, -1 if addr is bad
+ * @revisions
+ *   GJE p5  - Created
+ *           - Key waiters by user address and address space
+ */
+int futex_wake(int* addr, int n)
+{
+	struct proc* p = myproc();
+	int woken;
+
+	acquire(&ptable.lock);
+	if (futexword(p, addr) == 0)
+	{
+		release(&ptable.lock);
+		return -1;
+	}
+	woken = wakeupn(addr, p->mm, n);
+	release(&ptable.lock);
+	return woken;
+}
+
+/*
+ * Report ticket info for the process with the lowest pid above pid.
+ * Start from pid 0 and pass back each pid returned to visit every
+ * process.
+ * @param pid The pid to report the successor of
+ * @param pstat Pointer to pstat struct to fill with the process's data
+ * @returns the pid reported, 0 if there are no more processes
+ * @revisions
+ *   GJE p2b - Created
+ *   GJE p5  - Report migrations
+ *           - Report effective tickets
+ *           - Report group tickets
+ *           - Report user, system and wait time
+ *           - Report one process per call, walking allproc by pid
+ *           - Report last cpu and affinity
+ *           - Copy out after releasing ptable.lock
+ */
+int getpinfo(int pid, struct pstat* pstat)
+{
+	struct proc* p;
+	struct pstat ps;
+
+	acquire(&ptable.lock);
+
+	// Resume right after pid if it is still around.
+	for (p = ptable.pidhash[PIDHASH(pid)]; p != 0 && p->pid != pid; p = p->pidnext)
+		;
+	p = p != 0 ? p->allnext : ptable.allproc;
+	while (p != 0 && p->pid <= pid)
+	{
+		p = p->allnext;
+	}
+	if (p == 0)
+	{
+		release(&ptable.lock);
+		return 0;
+	}
+
+	ps.pid = p->pid;
+	safestrcpy(ps.name, p->name, sizeof(ps.name));
+	ps.tickets = p->tickets;
+	ps.grouptickets = p->group ? p->group->tickets : 0;
+	ps.ticks = p->ticks;
+	ps.utime = udiv64(p->utime, tscperus);
+	ps.stime = udiv64(p->stime, tscperus);
+	ps.wtime = udiv64(p->wtime, tscperus);
+	ps.migrations = p->migrations;
+	ps.efftickets = p->efftickets;
+	ps.cpu = p->lastcpu ? p->lastcpu - cpus : -1;
+	ps.affinity = p->affinity;
+	pid = p->pid;
+	release(&ptable.lock);
+
+	// Not under ptable.lock: the page may be copy-on-write
+	if (uvmcopyout(myproc()->mm, (uint)pstat, &ps, sizeof(ps)) < 0)
+	{
+		return -1;
+	}
+	return pid;
+}
+
+
+/*
+ * Sets the number of tickets for the calling process, which are
+ * shared with any threads in its address space
+ * @param number The number of tickets to set for the process, at most
+ *               EFFTICKETS_MAX so run queue sums can't overflow
+ * @returns 0 if successful, -1 otherwise
+ * @revisions
+ *   GJE p2b - Created
+ *   GJE p5  - Keep run queue ticket sums up to date
+ *           - Fund the process's ticket group
+ *           - Refuse more than EFFTICKETS_MAX
+ */
+int settickets(int number)
+{
+	if (number <= 0 || number > EFFTICKETS_MAX)
+	{
+		return -1;
+	}
+	acquire(&ptable.lock);
+	myproc()->group->tickets = number;
+	groupsplit(myproc()->group);
+	release(&ptable.lock);
+	return 0;
+}
+
+/*
+ * Selects the policy every cpu uses to pick from its run queue
+ * @param policy SCHED_LOTTERY or SCHED_STRIDE
+ * @returns the previous policy if sucessful, -1 otherwise
+ * @revisions
+ *   GJE p5  - Created
+ */
+int setsched(int policy)
+{
+	int old;
+
+	if (policy != SCHED_LOTTERY && policy != SCHED_STRIDE)
+	{
+		return -1;
+	}
+	acquire(&ptable.lock);
+	old = schedpolicy;
+	schedpolicy = policy;
+	release(&ptable.lock);
+	return old;
+}
+
+/*
+ * Restricts the cpus a process may run on. A queued process moves to
+ * an allowed cpu at once, a running one when it next leaves its cpu;
+ * the caller yields right away if its own cpu is ruled out.
+ * @param pid The process, or 0 for the caller
+ * @param mask Bit i set to allow cpu i; bits past the last cpu are
+ *             ignored
+ * @returns 0 if successful, -1 if there is no such process or mask
+ *          allows no cpu
+ * @revisions
+ *   GJE p5  - Created
+ */
+int setaffinity(int pid, uint mask)
+{
+	struct proc* curproc = myproc();
+	struct proc* p;
+	uint64 tstamp;
+	int move;
+
+	mask &= (1 << ncpu) - 1;
+	if (mask == 0)
+	{
+		return -1;
+	}
+	acquire(&ptable.lock);
+	p = curproc;
+	if (pid != 0)
+	{
+		for (p = ptable.pidhash[PIDHASH(pid)]; p != 0 && p->pid != pid; p = p->pidnext)
+			;
+	}
+	if (p == 0 || p->state == ZOMBIE)
+	{
+		release(&ptable.lock);
+		return -1;
+	}
+	p->affinity = mask;
+	if (p->rqcpu != 0 && !(mask & CPUBIT(p->rqcpu)))
+	{
+		// Requeue without losing the time it has waited so far.
+		tstamp = p->tstamp;
+		rqremove(p);
+		setrunnable(p);
+		p->tstamp = tstamp;
+	}
+	move = p == curproc && !(mask & CPUBIT(mycpu()));
+	release(&ptable.lock);
+	if (move)
+	{
+		yield();
+	}
+	return 0;
+}
+
+/*
+ * Sets the quantum every cpu gives a process before preempting it
+ * for another. Takes effect at each cpu's next dispatch.
+ * @param us The quantum in microseconds
+ * @returns the previous quantum if sucessful, -1 otherwise
+ * @revisions
+ *   GJE p5  - Created
+ */
+int setquantum(int us)
+{
+	int old;
+
+	if (us < QUANTUM_MIN || us > QUANTUM_MAX)
+	{
+		return -1;
+	}
+	acquire(&ptable.lock);
+	old = quantum;
+	quantum = us;
+	release(&ptable.lock);
+	return old;
+}
+
+/*
+ * Reports kernel-wide counters
+ * @param kstat The struct to fill
+ * @returns 0
+ * @revisions
+ *   GJE p5  - Created
+ *           - Report wakeups issued and processes woken
+ *           - Report free blocks by order
+ *           - Report zeroed pages
+ */
+int getkstat(struct kstat* kstat)
+{
+	int i;
+
+	memset(kstat, 0, sizeof(*kstat));
+	kstat->ncpu = ncpu;
+	kstat->ticks = ticks;
+	kstat->wakeups = ptable.wakeups;
+	kstat->woken = ptable.woken;
+	kfreeblocks(kstat->freeblocks);
+	kstat->zeroed = kzeroed();
+	for (i = 0; i < ncpu; i++)
+	{
+		kstat->timerintr[i] = cpus[i].ntimer;
+		kstat->intr[i] = cpus[i].nintr;
 	}
-	myproc()->tickets = number;
 	return 0;
 }
 
@@ -768,7 +2172,9 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  // Freed procs stay mapped in proccache, so walking the list
+  // unlocked can at worst print garbage.
+  for(p = ptable.allproc; p != 0; p = p->allnext){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
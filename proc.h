@@ -2,10 +2,49 @@
  * @revisions
  *   GJE p2b - add tickets count to process state
  *   GJE p4b - add CLONE_NARGS parameter
+ *   GJE p5  - add per-CPU run queues
+ *           - keep run queue tickets in a Fenwick tree
+ *           - add stride scheduling state
+ *           - add per-CPU random number generator state
+ *           - add load balancing state
+ *           - add idle flag for halted cpus
+ *           - add quantum deadline and interrupt counters
+ *           - add compensation tickets
+ *           - add ticket group
+ *           - add user, system and wait time
+ *           - add pid hash chain, child list and thread list links
+ *           - add wait channel hash chain
+ *           - add allproc list links
+ *           - add thread-local storage base
+ *           - share pgdir and sz between threads through struct mm
+ *           - add address space loaded on each cpu
+ *           - add last cpu and cpu affinity
+ *           - allocate run queue arrays as processes are allocated
  */
 
 #define CLONE_NARGS (3)
 
+// Per-CPU set of RUNNABLE processes for the lottery scheduler.
+// Protected by ptable.lock, like the state of the processes in it.
+// Only nrunnable is read without it, as a hint for idle cpus. So the
+// per-CPU queues shrink the work done under ptable.lock on dispatch
+// (one cpu's queue, not the whole table) but not the serialization:
+// every dispatch still takes ptable.lock, since it is held across
+// swtch() and for every sleep/wakeup state change. A lock per queue
+// would need that switch protocol reworked around the queue locks.
+// fenwick[] is a 1-indexed binary indexed tree over the efftickets of
+// proc[], so a lottery draw is a log(nrunnable) descent instead of
+// a scan of the queue. Both live in one block from kallocpages(),
+// grown as the number of processes grows (see rqreserve()).
+struct runqueue {
+  struct proc **proc;          // Queued processes; [0, nrunnable) in use
+  int *fenwick;                // Partial sums of proc[i]->efftickets
+  int size;                    // Slots in proc; fenwick has size+1
+  volatile int nrunnable;      // Number of queued processes
+  int tickets;                 // Sum of the tickets of queued processes
+  uint pass;                   // Stride clock: latest pass dispatched
+};
+
 // Per-CPU state
 struct cpu {
   uchar apicid;                // Local APIC ID
@@ -16,6 +55,14 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  struct runqueue rq;          // Processes waiting to run on this cpu
+  uint64 rand;                 // Lottery random number state (see rand.c)
+  uint lastbalance;            // Value of ticks when we last balanced
+  volatile int idle;           // Halted in scheduler() waiting for work
+  uint64 qend;                 // TSC deadline of the running process's quantum
+  uint ntimer;                 // Timer interrupts taken
+  uint nintr;                  // Interrupts of any kind taken
+  struct mm *mm;               // Address space in %cr3, or 0 for kpgdir
 };
 
 extern struct cpu cpus[NCPU];
@@ -44,21 +91,43 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
-  uint sz;                     // Size of process memory (bytes)
-  pde_t* pgdir;                // Page table
+  struct mm *mm;               // Address space (page table and size)
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
+  struct proc *children;       // First child (process or thread) we created
+  struct proc *sibling;        // Next child of our parent
+  struct proc *pidnext;        // Next process in our pid hash bucket
+  struct proc *allnext;        // Next process, by pid, on allproc
+  struct proc *allprev;        // Previous process on allproc
+  struct proc *threadnext;     // Next thread in our ticket group
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
+  struct proc *channext;       // Next sleeper in our wait channel bucket
   int killed;                  // If non-zero, have been killed
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
-  int tickets;                 // The number of tickets for this process
-  int ticks;                   // The number of ticks process has accumulated
+  uint tls;                    // Base of the SEG_UTLS segment, or 0
+  struct tgroup *group;        // Ticket group funding this process
+  int tickets;                 // This process's share of the group's tickets
+  int efftickets;              // Tickets plus compensation, until next run
+  uint64 dispatched;           // TSC when last dispatched
+  uint64 utime;                // TSC cycles spent in user mode
+  uint64 stime;                // TSC cycles spent in the kernel
+  uint64 wtime;                // TSC cycles spent RUNNABLE, waiting for a cpu
+  uint64 tstamp;               // TSC when time was last charged
+  int ticks;                   // The number of times process was dispatched
+  uint stride;                 // STRIDE1 / tickets
+  uint pass;                   // Stride virtual time of next dispatch
+  uint lastrun;                // Value of ticks when last dispatched
+  int migrations;              // Times run on a different cpu than last
+  struct cpu *lastcpu;         // Cpu that last ran us, 0 if none has
+  uint affinity;               // Bit i set if cpus[i] may run us
+  struct cpu *rqcpu;           // If RUNNABLE, cpu whose run queue holds us
+  int rqidx;                   // If RUNNABLE, index in rqcpu->rq.proc
 };
 
 // Process memory is laid out contiguously, low addresses first:
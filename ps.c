@@ -5,6 +5,12 @@
  * @version: 1.0
  * @revisions:
  *   GJE p2b - Created
+ *   GJE p5  - show migrations
+ *           - show effective tickets
+ *           - show group tickets
+ *           - show user, system and wait time instead of dispatches
+ *           - walk processes with the getpinfo() iterator; show names
+ *           - show last cpu
  */
 
 #include "types.h"
@@ -15,19 +21,19 @@
 int main(void)
 {
 	struct pstat p;
-	if (getpinfo(&p) < 0)
+	int pid = 0;
+
+	printf(1, "\tPID\tGroup\tTickets\tEff\tUser ms\tSys ms\tWait ms\tMoves\tCPU\tName\n");
+	while ((pid = getpinfo(pid, &p)) > 0)
 	{
-		printf(1, "Error:ps.c: Could not get process info\n");
-		exit();
+		printf(1, "\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%s\n", p.pid,
+			   p.grouptickets, p.tickets, p.efftickets,
+			   p.utime / 1000, p.stime / 1000, p.wtime / 1000,
+			   p.migrations, p.cpu, p.name);
 	}
-
-	printf(1, "\tPID\tTickets\tTicks\n");
-	for (int i=0; i < NPROC; i++)
+	if (pid < 0)
 	{
-		if (p.inuse[i] == 1)
-		{
-			printf(1, "\t%d\t%d\t%d\n", p.pid[i], p.tickets[i], p.ticks[i]);
-		}
+		printf(1, "Error:ps.c: Could not get process info\n");
 	}
 	exit();
 }
@@ -5,23 +5,44 @@
  * @version 1.0
  * @revisions
  *   GJE p2b - Created
+ *   GJE p5  - add migrations
+ *           - add efftickets
+ *           - add grouptickets
+ *           - add user, system and wait time
+ *           - describe one process per getpinfo() call instead of
+ *             every slot of a fixed process table
+ *           - add cpu and affinity
  */
 
 #ifndef _PSTAT_H_
 #define _PSTAT_H_
 
-#include "param.h"
-
 struct pstat
 {
-	/* whether this slot of the process table is in use (1 or 0) */
-	int inuse[NPROC];
-	/* the number of tickets this process has */
-	int tickets[NPROC];
-	/* the PID of each process */
-	int pid[NPROC];
-	/* the number of ticks each process has accumulated */
-	int ticks[NPROC];
+	/* the PID of the process */
+	int pid;
+	/* the process name */
+	char name[16];
+	/* the number of tickets this process has: its share of its group's */
+	int tickets;
+	/* the tickets funding the group of threads sharing this address space */
+	int grouptickets;
+	/* the number of times the process has been scheduled */
+	int ticks;
+	/* the microseconds the process has run in user mode */
+	uint utime;
+	/* the microseconds the process has run in the kernel */
+	uint stime;
+	/* the microseconds the process has been runnable but not running */
+	uint wtime;
+	/* the number of times the process moved between cpus */
+	int migrations;
+	/* the tickets the process draws with, including compensation */
+	int efftickets;
+	/* the cpu that last ran the process, -1 if none has yet */
+	int cpu;
+	/* bit i set if cpu i may run the process */
+	uint affinity;
 };
 
 #endif // _PSTAT_H_
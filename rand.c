@@ -5,17 +5,60 @@
  * @version 1.0
  * @revisions
  *   GJE p2b - Created
+ *   GJE p5  - Replace shared LCG seed with a PCG32 generator over
+ *             caller-owned state, so each cpu can keep its own
  */
 
+#include "types.h"
 #include "rand.h"
 
-static int Seed = 999999;
-const int Modulus = 0x7FFFFFFF;
-const int Multiplier = 0x138D395;
-const int Increment = 12345;
+const uint64 Multiplier = 6364136223846793005ULL;
+const uint64 Increment = 1442695040888963407ULL;
 
+static uint64 Seed = 0x853c49e6748fea9bULL;
+
+/*
+ * Advances a PCG32 (XSH RR) generator one step
+ * @param state generator state, owned by the caller
+ * @returns the next 32 pseudo-random bits
+ * @revisions
+ *   GJE p5  - Created. Implementation: pcg-random.org, M. O'Neill.
+ */
+uint randnext(uint64* state)
+{
+	uint64 old = *state;
+	uint xorshifted;
+	uint rot;
+
+	*state = old * Multiplier + Increment;
+	xorshifted = (uint)(((old >> 18) ^ old) >> 27);
+	rot = (uint)(old >> 59);
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+/*
+ * Seeds a generator
+ * @param state generator state to initialize
+ * @param seed any value; different seeds give different sequences
+ * @revisions
+ *   GJE p5  - Created
+ */
+void randseed(uint64* state, uint64 seed)
+{
+	*state = 0;
+	randnext(state);
+	*state += seed;
+	randnext(state);
+}
+
+/*
+ * Returns a non-negative pseudo-random int from a generator private to
+ * this program. Not safe to call from several threads at once.
+ * @revisions
+ *   GJE p2b - Created
+ *   GJE p5  - Use the PCG32 generator
+ */
 int rand0()
 {
-	Seed = (Multiplier * Seed + Increment) & Modulus;
-	return Seed;
+	return randnext(&Seed) & 0x7FFFFFFF;
 }
@@ -1 +1,8 @@
+/*
+ * @revisions
+ *   GJE p5  - add randnext and randseed for caller-owned state
+ */
+
+uint randnext(uint64* state);
+void randseed(uint64* state, uint64 seed);
 extern int rand0(void);
@@ -0,0 +1,26 @@
+/*
+ * Scheduling policies selectable at boot or with setsched()
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+/* proportional share by random draw over tickets */
+#define SCHED_LOTTERY (0)
+/* proportional share by deterministic stride over tickets */
+#define SCHED_STRIDE  (1)
+
+/* policy the kernel boots with, e.g. `make SCHED=STRIDE qemu` */
+#ifndef SCHEDPOLICY
+#define SCHEDPOLICY SCHED_LOTTERY
+#endif
+
+/* stride of a process holding a single ticket */
+#define STRIDE1 (1 << 20)
+
+#endif // _SCHED_H_
@@ -0,0 +1,224 @@
+/*
+ * Object caches for fixed-size kernel structures that come and go,
+ * such as processes, so their number isn't fixed at compile time.
+ * 
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ *           - per-cpu magazines in front of the free list; usage
+ *             counters reported by kcache_stat()
+ */
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "slabstat.h"
+
+// A free object, linked through its first word.
+struct kobj {
+	struct kobj* next;
+};
+
+// Every cache, newest first. Caches are made at boot, before other
+// cpus start, and never destroyed, so the list needs no lock.
+static struct kcache* s_caches;
+
+/*
+ * Sets up an empty cache
+ * @param c The cache
+ * @param name Name of the cache (debugging)
+ * @param size Size of each object in bytes, at most a page
+ * @revisions
+ *   GJE p5  - Created
+ *           - Empty magazines; add to the list of caches
+ */
+void kcache_init(struct kcache* c, char* name, uint size)
+{
+	if (size > PGSIZE)
+	{
+		panic("kcache_init");
+	}
+	memset(c, 0, sizeof(*c));
+	initlock(&c->lock, name);
+	c->name = name;
+	c->size = (size + sizeof(struct kobj) - 1) & ~(sizeof(struct kobj) - 1);
+	c->next = s_caches;
+	s_caches = c;
+}
+
+/*
+ * Carves a fresh page into objects for the free list.
+ * Caller must hold c->lock.
+ * @param c The cache
+ * @returns 0 if sucessful, -1 if out of memory
+ * @revisions
+ *   GJE p5  - Created
+ *           - Count pages
+ */
+static int kcache_grow(struct kcache* c)
+{
+	char* page;
+	char* obj;
+	struct kobj* o;
+
+	if ((page = kalloc()) == 0)
+	{
+		return -1;
+	}
+	for (obj = page; obj + c->size <= page + PGSIZE; obj += c->size)
+	{
+		o = (struct kobj*)obj;
+		o->next = c->free;
+		c->free = o;
+		c->nobj++;
+	}
+	c->npages++;
+	return 0;
+}
+
+/*
+ * Fills a cpu's empty magazine halfway from the free list, growing
+ * the cache as needed. Caller is on that cpu with interrupts off.
+ * @param c The cache
+ * @param m The magazine
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void kcache_refill(struct kcache* c, struct kmagazine* m)
+{
+	struct kobj* o;
+
+	acquire(&c->lock);
+	while (m->n < MAGSIZE / 2 && (c->free || kcache_grow(c) == 0))
+	{
+		o = c->free;
+		c->free = o->next;
+		m->objs[m->n++] = o;
+		c->ninuse++;
+	}
+	c->nrefill++;
+	release(&c->lock);
+}
+
+/*
+ * Returns half of a cpu's full magazine to the free list.
+ * Caller is on that cpu with interrupts off.
+ * @param c The cache
+ * @param m The magazine
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void kcache_drain(struct kcache* c, struct kmagazine* m)
+{
+	struct kobj* o;
+
+	acquire(&c->lock);
+	while (m->n > MAGSIZE / 2)
+	{
+		o = m->objs[--m->n];
+		o->next = c->free;
+		c->free = o;
+		c->ninuse--;
+	}
+	release(&c->lock);
+}
+
+/*
+ * Takes an object from a cache
+ * @param c The cache
+ * @returns a zeroed object, 0 if out of memory
+ * @revisions
+ *   GJE p5  - Created
+ *           - Take it from this cpu's magazine
+ */
+void* kcache_alloc(struct kcache* c)
+{
+	struct kmagazine* m;
+	void* o = 0;
+
+	pushcli();
+	m = &c->mag[cpuid()];
+	if (m->n == 0)
+	{
+		kcache_refill(c, m);
+	}
+	if (m->n > 0)
+	{
+		o = m->objs[--m->n];
+		c->nalloc++;
+	}
+	popcli();
+
+	if (o)
+	{
+		memset(o, 0, c->size);
+	}
+	return o;
+}
+
+/*
+ * Returns an object to the cache it came from
+ * @param c The cache
+ * @param obj The object
+ * @revisions
+ *   GJE p5  - Created
+ *           - Put it in this cpu's magazine
+ */
+void kcache_free(struct kcache* c, void* obj)
+{
+	struct kmagazine* m;
+
+	pushcli();
+	m = &c->mag[cpuid()];
+	if (m->n == MAGSIZE)
+	{
+		kcache_drain(c, m);
+	}
+	m->objs[m->n++] = obj;
+	popcli();
+}
+
+/*
+ * Describes the usage of a cache
+ * @param i Position of the cache in the list of caches
+ * @param st OUTPUT the cache's figures
+ * @returns 0 if sucessful, -1 if there are no more than i caches
+ * @revisions
+ *   GJE p5  - Created
+ *           - Store to st after releasing the lock
+ */
+int kcache_stat(int i, struct slabstat* st)
+{
+	struct kcache* c;
+	struct slabstat s;
+	int inmags = 0;
+
+	for (c = s_caches; c && i > 0; c = c->next, i--)
+		;
+	if (c == 0 || i < 0)
+	{
+		return -1;
+	}
+
+	acquire(&c->lock);
+	safestrcpy(s.name, c->name, sizeof(s.name));
+	s.size = c->size;
+	s.npages = c->npages;
+	s.nobj = c->nobj;
+	for (int j = 0; j < NCPU; j++)
+	{
+		inmags += c->mag[j].n;
+	}
+	s.ninuse = c->ninuse - inmags;
+	s.nalloc = c->nalloc;
+	s.nrefill = c->nrefill;
+	release(&c->lock);
+
+	// st may be user memory, which can fault; not under c->lock
+	*st = s;
+	return 0;
+}
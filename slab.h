@@ -0,0 +1,44 @@
+/*
+ * Definition of kcache struct: a cache of fixed-size kernel objects
+ * 
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ *           - per-cpu magazines, usage counters, list of all caches
+ */
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+struct kobj;
+
+// Objects a magazine holds. An empty one takes MAGSIZE/2 from the
+// cache's free list; a full one gives MAGSIZE/2 back.
+#define MAGSIZE 16
+
+// A cpu's stack of free objects, used without the cache lock.
+struct kmagazine {
+  int n;                  // Objects in objs
+  void *objs[MAGSIZE];
+} __attribute__((__aligned__(64)));
+
+// Objects are carved out of whole pages from kalloc() and kept on a
+// free list once freed. Pages are never given back, so a cache holds
+// on to its high-water mark. Each cpu allocates from and frees to its
+// own magazine, and takes the lock only to refill or empty it.
+struct kcache {
+  struct spinlock lock;
+  char *name;          // Name of cache (debugging)
+  uint size;           // Object size, rounded up to a pointer
+  struct kobj *free;   // Objects ready to hand out
+  uint nobj;           // Objects carved out so far
+  uint ninuse;         // Objects out of the free list, in magazines or used
+  uint npages;         // Pages taken from kalloc()
+  uint nalloc;         // Objects handed out, ever (approximate)
+  uint nrefill;        // Magazine refills from the free list
+  struct kcache *next; // Next in the list of all caches
+  struct kmagazine mag[NCPU];
+};
+
+#endif // _SLAB_H_
@@ -0,0 +1,32 @@
+/*
+ * Definition of slabstat struct: the usage of a kernel object cache,
+ * as reported by getslabstat()
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#ifndef _SLABSTAT_H_
+#define _SLABSTAT_H_
+
+struct slabstat
+{
+	/* the name of the cache */
+	char name[16];
+	/* the size of each object, in bytes */
+	uint size;
+	/* the pages the cache has taken from the page allocator */
+	uint npages;
+	/* the objects carved out of those pages */
+	uint nobj;
+	/* the objects allocated and not freed */
+	uint ninuse;
+	/* the allocations made, ever (approximate) */
+	uint nalloc;
+	/* the times a cpu's magazine was refilled from the shared free list */
+	uint nrefill;
+};
+
+#endif // _SLABSTAT_H_
@@ -8,6 +8,16 @@
  *           - add munprotect syscall
  *   GJE p4b - add clone syscall
  *           - add join syscall
+ *   GJE p5  - add setsched syscall
+ *           - add setquantum syscall
+ *           - add getkstat syscall
+ *           - add futex_wait syscall
+ *           - add futex_wake syscall
+ *           - check addresses against the shared struct mm
+ *           - add argwptr for buffers the kernel writes to
+ *           - argptr faults in lazily allocated heap pages
+ *           - add setaffinity syscall
+ *           - add getslabstat syscall
  */
 
 #include "types.h"
@@ -16,6 +26,9 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "mm.h"
 #include "x86.h"
 #include "syscall.h"
 #include "pstat.h"
@@ -32,7 +45,7 @@ fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(addr >= curproc->mm->sz || addr+4 > curproc->mm->sz)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -47,10 +60,10 @@ fetchstr(uint addr, char **pp)
   char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if(addr >= curproc->mm->sz)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
+  ep = (char*)curproc->mm->sz;
   for(s = *pp; s < ep; s++){
     if(*s == 0)
       return s - *pp;
@@ -67,7 +80,13 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
+// lies within the process address space, and fault in any of
+// it sbrk() left unallocated, as the kernel may read it where
+// it can't take a fault.
+/*
+ * @revisions
+ *   GJE p5  - Allocate lazy heap pages in the block
+ */
 int
 argptr(int n, char **pp, int size)
 {
@@ -76,12 +95,38 @@ argptr(int n, char **pp, int size)
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (uint)i >= curproc->mm->sz || (uint)i+size > curproc->mm->sz)
     return -1;
   *pp = (char*)i;
+  if(size > 0 && uvmfault(curproc->mm, i, size, 0) < 0)
+    return -1;
   return 0;
 }
 
+/*
+ * Like argptr(), for a buffer the kernel will write to: also breaks
+ * copy-on-write in it now, since the write itself may happen where a
+ * fault can't be handled, such as under a spinlock.
+ * @param n Argument number
+ * @param pp OUTPUT the pointer
+ * @param size Size of the buffer
+ * @returns 0 if the buffer is writable user memory, -1 otherwise
+ * @revisions
+ *   GJE p5  - Created
+ */
+int argwptr(int n, char** pp, int size)
+{
+	if (argptr(n, pp, size) < 0)
+	{
+		return -1;
+	}
+	if (size == 0)
+	{
+		return 0;
+	}
+	return uvmfault(myproc()->mm, (uint)*pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -125,6 +170,13 @@ extern int sys_mprotect(void);
 extern int sys_munprotect(void);
 extern int sys_clone(void);
 extern int sys_join(void);
+extern int sys_setsched(void);
+extern int sys_setquantum(void);
+extern int sys_getkstat(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
+extern int sys_setaffinity(void);
+extern int sys_getslabstat(void);
 
 static int (*syscalls[])(void) = {
 	[SYS_fork]         sys_fork,
@@ -156,7 +208,14 @@ static int (*syscalls[])(void) = {
 	[SYS_mprotect]     sys_mprotect,
 	[SYS_munprotect]   sys_munprotect,
 	[SYS_clone]        sys_clone,
-	[SYS_join]		   sys_join
+	[SYS_join]		   sys_join,
+	[SYS_setsched]     sys_setsched,
+	[SYS_setquantum]   sys_setquantum,
+	[SYS_getkstat]     sys_getkstat,
+	[SYS_futex_wait]   sys_futex_wait,
+	[SYS_futex_wake]   sys_futex_wake,
+	[SYS_setaffinity]  sys_setaffinity,
+	[SYS_getslabstat]  sys_getslabstat,
 };
 
 void
@@ -9,6 +9,13 @@
  *           - add SYS_munprotect
  *   GJE p4b - add SYS_clone
  *           - add SYS_join
+ *   GJE p5  - add SYS_setsched
+ *           - add SYS_setquantum
+ *           - add SYS_getkstat
+ *           - add SYS_futex_wait
+ *           - add SYS_futex_wake
+ *           - add SYS_setaffinity
+ *           - add SYS_getslabstat
  */
 
 #define SYS_fork          1
@@ -41,3 +48,10 @@
 #define SYS_munprotect   28
 #define SYS_clone		 29
 #define SYS_join		 30
+#define SYS_setsched     31
+#define SYS_setquantum   32
+#define SYS_getkstat     33
+#define SYS_futex_wait   34
+#define SYS_futex_wake   35
+#define SYS_setaffinity  36
+#define SYS_getslabstat  37
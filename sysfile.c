@@ -1,6 +1,7 @@
 /*
  * @revisions
  * GJE p1b - add sys_getreadcount syscall
+ * GJE p5  - read, fstat and pipe break copy-on-write in their buffers
  */
 
 //
@@ -86,7 +87,7 @@ int sys_read(void)
 	// track system calls to read()
 	ReadCount++;
 
-  	if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  	if (argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argwptr(1, &p, n) < 0)
 	{
 		return -1;
 	}
@@ -136,7 +137,7 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argwptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -453,7 +454,7 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argwptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
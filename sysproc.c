@@ -8,6 +8,18 @@
  *           - add sys_munprotect syscall
  *   GJE p4b - add sys_clone syscall
  *           - add sys_join syscall
+ *   GJE p5  - add sys_setsched syscall
+ *           - add sys_setquantum syscall
+ *           - add sys_getkstat syscall
+ *           - getpinfo takes the pid to continue after
+ *           - add sys_futex_wait and sys_futex_wake syscalls
+ *           - sys_clone takes a thread-local storage pointer
+ *           - sys_sbrk returns the size growproc() grew from
+ *           - mprotect and munprotect flush TLBs once per call
+ *           - add sys_setaffinity syscall
+ *           - break copy-on-write in buffers the kernel fills
+ *           - mprotect and munprotect fault in lazy heap pages first
+ *           - add sys_getslabstat syscall
  */
 
 #include "types.h"
@@ -18,7 +30,12 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "mm.h"
 #include "pstat.h"
+#include "kstat.h"
+#include "slabstat.h"
 
 int
 sys_fork(void)
@@ -31,19 +48,21 @@ sys_fork(void)
  * @returns pid of the created process if successful, -1 otherwise
  * @revisions
  *   GJE p4b - Created
+ *   GJE p5  - Pass through the TLS pointer
  */
 int sys_clone(void)
 {
-	uint ufcn, uarg1, uarg2, ustack;
+	uint ufcn, uarg1, uarg2, ustack, utls;
 
 	if (argint(0, (int*)&ufcn) < 0 || argint(1, (int*)&uarg1) < 0
-		|| argint(2, (int*)&uarg2) < 0 || argint(3, (int*)&ustack) < 0)
+		|| argint(2, (int*)&uarg2) < 0 || argint(3, (int*)&ustack) < 0
+		|| argint(4, (int*)&utls) < 0)
 	{
 		return -1;
 	}
 
 	return clone((void(*)(void*,void*))ufcn, (void*)uarg1, 
-				 (void*)uarg2, (void*)ustack);
+				 (void*)uarg2, (void*)ustack, (void*)utls);
 }
 
 /*
@@ -51,11 +70,14 @@ int sys_clone(void)
  * @returns pid of exited thread if sucessful, -1 otherwise
  * @revisions
  *   GJE p4b - Created
+
+ *   GJE p5  - validate the stack pointer slot
  */
 int sys_join(void)
 {
-	uint ustack;
-	if (argint(0, (int*)&ustack) < 0)
+	char* ustack;
+
+	if (argptr(0, &ustack, sizeof(void*)) < 0)
 	{
 		return -1;
 	}
@@ -106,15 +128,13 @@ int sys_getppid(void)
 int
 sys_sbrk(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  // Another thread may grow the space too; only growproc() knows
+  // where our piece starts.
+  return growproc(n);
 }
 
 int
@@ -169,20 +189,145 @@ int sys_settickets(void)
 }
 
 /*
- * System call to report info for all running processes
- * @returns 0 if sucessful, -1 otherwise
+ * System call to report info for the process after a given pid
+ * @returns the pid reported, 0 after the last process, -1 on error
  * @revisions
  *   GJE p2b - Created
+ *   GJE p5  - Take the pid to continue after
  */
 int sys_getpinfo(void)
 {
+	int pid;
 	struct pstat* p;
 	
-	if (argptr(0, (void*)&p, sizeof(struct pstat)) < 0)
+	if (argint(0, &pid) < 0 || argwptr(1, (void*)&p, sizeof(struct pstat)) < 0)
+	{
+		return -1;
+	}
+	return getpinfo(pid, p);
+}
+
+/*
+ * System call to select the scheduling policy used by every cpu.
+ * @returns the previous policy if sucessful, -1 otherwise
+ * @revisions
+ *   GJE p5  - Created
+ */
+int sys_setsched(void)
+{
+	int policy;
+
+	if (argint(0, &policy) < 0)
+	{
+		return -1;
+	}
+	return setsched(policy);
+}
+
+/*
+ * System call to set the scheduling quantum used by every cpu.
+ * @returns the previous quantum in microseconds if sucessful, -1 otherwise
+ * @revisions
+ *   GJE p5  - Created
+ */
+int sys_setquantum(void)
+{
+	int us;
+
+	if (argint(0, &us) < 0)
 	{
 		return -1;
 	}
-	return getpinfo(p);
+	return setquantum(us);
+}
+
+/*
+ * System call to restrict the cpus a process may run on.
+ * @returns 0 if sucessful, -1 otherwise
+ * @revisions
+ *   GJE p5  - Created
+ */
+int sys_setaffinity(void)
+{
+	int pid;
+	int mask;
+
+	if (argint(0, &pid) < 0 || argint(1, &mask) < 0)
+	{
+		return -1;
+	}
+	return setaffinity(pid, (uint)mask);
+}
+
+/*
+ * System call to report the usage of a kernel object cache
+ * @returns 0 if sucessful, -1 if there is no such cache or on error
+ * @revisions
+ *   GJE p5  - Created
+ */
+int sys_getslabstat(void)
+{
+	int i;
+	struct slabstat* st;
+
+	if (argint(0, &i) < 0 || argwptr(1, (void*)&st, sizeof(struct slabstat)) < 0)
+	{
+		return -1;
+	}
+	return kcache_stat(i, st);
+}
+
+/*
+ * System call to sleep on a futex word while it holds an expected value
+ * @returns 0 once woken, -1 if the word changed or on error
+ * @revisions
+ *   GJE p5  - Created
+ */
+int sys_futex_wait(void)
+{
+	int* addr;
+	int expected;
+
+	if (argptr(0, (void*)&addr, sizeof(int)) < 0 || argint(1, &expected) < 0)
+	{
+		return -1;
+	}
+	return futex_wait(addr, expected);
+}
+
+/*
+ * System call to wake processes sleeping on a futex word
+ * @returns the number of processes woken, -1 on error
+ * @revisions
+ *   GJE p5  - Created
+ */
+int sys_futex_wake(void)
+{
+	int* addr;
+	int n;
+
+	if (argptr(0, (void*)&addr, sizeof(int)) < 0 || argint(1, &n) < 0)
+	{
+		return -1;
+	}
+	return futex_wake(addr, n);
+}
+
+/*
+ * System call to report kernel-wide counters
+ * @returns 0 if sucessful, -1 otherwise
+ * @revisions
+ *   GJE p5  - Created
+ */
+int sys_getkstat(void)
+{
+	struct kstat* k;
+
+	if (argwptr(0, (void*)&k, sizeof(struct kstat)) < 0)
+	{
+		return -1;
+	}
+	return getkstat(k);
 }
 
 /*
@@ -215,15 +360,24 @@ int sys_mprotect(void)
 	{
 		return -1;
 	}
-	if (n <= 0)
+	if (n <= 0 || n > KERNBASE / PGSIZE)
+	{
+		return -1;
+	}
+	// Heap pages not allocated yet would fault in with the wrong access
+	if (uvmfault(curproc->mm, (uint)uva, n * PGSIZE, 0) < 0)
 	{
 		return -1;
 	}
 
+	// One flush for the whole range, on only the cpus that need it
+	acquiresleep(&curproc->mm->lock);
 	for( int i = 0; i < n; i++)
 	{
-		clearptew(curproc->pgdir, uva + i * PGSIZE);
+		clearptew(curproc->mm->pgdir, uva + i * PGSIZE);
 	}
+	tlbflush(curproc->mm);
+	releasesleep(&curproc->mm->lock);
 
 	return 0;
 }
@@ -246,15 +400,24 @@ int sys_munprotect(void)
 	{
 		return -1;
 	}
-	if (n <= 0)
+	if (n <= 0 || n > KERNBASE / PGSIZE)
+	{
+		return -1;
+	}
+	// Heap pages not allocated yet would fault in with the wrong access
+	if (uvmfault(curproc->mm, (uint)uva, n * PGSIZE, 0) < 0)
 	{
 		return -1;
 	}
 
+	// One flush for the whole range, on only the cpus that need it
+	acquiresleep(&curproc->mm->lock);
 	for( int i = 0; i < n; i++)
 	{
-		permitptew(curproc->pgdir, uva + i * PGSIZE);
+		permitptew(curproc->mm->pgdir, uva + i * PGSIZE);
 	}
+	tlbflush(curproc->mm);
+	releasesleep(&curproc->mm->lock);
 
 	return 0;
 }
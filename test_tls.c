@@ -0,0 +1,97 @@
+/*
+ * Test routine for thread-local storage.
+ * Each thread must find its own thread_t through %gs, and a
+ * fork()ed child must keep its parent's.
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+
+#define NTHREADS (4)
+
+/* set by each thread when its thread_self() matched */
+static volatile int s_ok[NTHREADS];
+
+void check(void*, void*);
+
+int main(void)
+{
+	int i;
+
+	if (thread_self() != 0)
+	{
+		printf(1, "test_tls: main thread has a thread_t\n");
+		exit();
+	}
+
+	for (i = 0; i < NTHREADS; i++)
+	{
+		if (thread_create(check, (void*)i, 0) < 0)
+		{
+			printf(1, "test_tls: thread_create failed\n");
+			exit();
+		}
+	}
+	for (i = 0; i < NTHREADS; i++)
+	{
+		thread_join();
+	}
+
+	for (i = 0; i < NTHREADS; i++)
+	{
+		if (!s_ok[i])
+		{
+			printf(1, "test_tls: thread %d saw the wrong thread_t\n", i);
+			exit();
+		}
+	}
+	printf(1, "test_tls: passed\n");
+	exit();
+}
+
+/*
+ * Thread body: stores its index in its own thread_t, yields so the
+ * others get to run and reload %gs, then checks it is still there.
+ * Thread 0 also checks that a fork()ed child inherits the segment.
+ * @param arg1 index of this thread
+ * @param arg2 unused
+ */
+void check(void* arg1, void* arg2)
+{
+	int i = (int)arg1;
+	thread_t* self = thread_self();
+	int pid;
+
+	if (self == 0 || self->self != self)
+	{
+		exit();
+	}
+	self->data = arg1;
+	yield();
+	if (thread_self() != self || (int)self->data != i)
+	{
+		exit();
+	}
+
+	if (i == 0)
+	{
+		pid = fork();
+		if (pid == 0)
+		{
+			if (thread_self() != self)
+			{
+				printf(1, "test_tls: fork lost the thread_t\n");
+			}
+			exit();
+		}
+		wait();
+	}
+
+	s_ok[i] = 1;
+	exit();
+}
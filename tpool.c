@@ -0,0 +1,368 @@
+/*
+ * Thread pool with work stealing, on top of thread_create() and
+ * thread_join(). Each worker keeps its own Chase-Lev deque: tasks a
+ * worker submits go on the bottom of its deque and it takes them back
+ * from there, newest first, while idle workers steal the oldest from
+ * the top. Tasks submitted from outside the pool go on one shared
+ * queue under a lock_t. Workers with nothing to do sleep on a futex.
+ *
+ * Nothing here calls malloc() after tpool_create(), since it isn't
+ * safe to from several threads at once; neither may tasks.
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+#include "rand.h"
+#include "tpool.h"
+
+#define DEQUE_MASK (TPOOL_DEQUE - 1)
+
+/*
+ * Finds the worker the caller is, if it is one of pool's
+ * @param pool The pool
+ * @returns the calling worker, 0 for a thread outside the pool
+ */
+static struct tpool_worker* tpool_self(struct tpool* pool)
+{
+	thread_t* self = thread_self();
+	struct tpool_worker* w;
+
+	if (self == 0)
+	{
+		return 0;
+	}
+	w = (struct tpool_worker*)self->data;
+	if (w < pool->workers || w >= pool->workers + pool->nworkers)
+	{
+		return 0;
+	}
+	return w;
+}
+
+/*
+ * Pushes a task on the bottom of the calling worker's own deque
+ * @param w The calling worker
+ * @returns 0 if queued, -1 if the deque is full
+ */
+static int dequepush(struct tpool_worker* w, void (*fn)(void*), void* arg)
+{
+	int b = w->bottom;
+
+	if (b - w->top >= TPOOL_DEQUE)
+	{
+		return -1;
+	}
+	w->tasks[b & DEQUE_MASK].fn = fn;
+	w->tasks[b & DEQUE_MASK].arg = arg;
+	// x86 doesn't reorder stores, so thieves see the task first.
+	w->bottom = b + 1;
+	return 0;
+}
+
+/*
+ * Pops the newest task off the bottom of the calling worker's deque
+ * @param w The calling worker
+ * @param t OUTPUT the task
+ * @returns 1 if a task was taken, 0 if the deque was empty
+ */
+static int dequepop(struct tpool_worker* w, struct tpool_task* t)
+{
+	int b = w->bottom - 1;
+	int top;
+
+	// Claim the bottom slot before looking at top; xchg is a full
+	// fence, so a thief can't read the old bottom after we read top.
+	xchg((volatile uint*)&w->bottom, b);
+	top = w->top;
+	if (top > b)
+	{
+		w->bottom = b + 1;
+		return 0;
+	}
+	t->fn = w->tasks[b & DEQUE_MASK].fn;
+	t->arg = w->tasks[b & DEQUE_MASK].arg;
+	if (top == b)
+	{
+		// The last task: thieves may be after it as well.
+		if (cmpxchg(&w->top, top, top + 1) != top)
+		{
+			w->bottom = b + 1;
+			return 0;
+		}
+		w->bottom = b + 1;
+	}
+	return 1;
+}
+
+/*
+ * Steals the oldest task off the top of another worker's deque
+ * @param w The worker to steal from
+ * @param t OUTPUT the task
+ * @returns 1 if a task was taken, 0 if empty or another thread won it
+ */
+static int dequesteal(struct tpool_worker* w, struct tpool_task* t)
+{
+	int top = w->top;
+	int b = w->bottom;
+
+	if (top >= b)
+	{
+		return 0;
+	}
+	t->fn = w->tasks[top & DEQUE_MASK].fn;
+	t->arg = w->tasks[top & DEQUE_MASK].arg;
+	return cmpxchg(&w->top, top, top + 1) == top;
+}
+
+/*
+ * Takes a task off the shared queue for submitters outside the pool
+ * @param pool The pool
+ * @param t OUTPUT the task
+ * @returns 1 if a task was taken, 0 if the queue was empty
+ */
+static int injecttake(struct tpool* pool, struct tpool_task* t)
+{
+	int found = 0;
+
+	// Racy peek, so idle workers don't fight over the lock for nothing
+	if (pool->injecttop == pool->injectbottom)
+	{
+		return 0;
+	}
+	lock_acquire(&pool->injectlock);
+	if (pool->injecttop != pool->injectbottom)
+	{
+		*t = pool->inject[pool->injecttop++ & DEQUE_MASK];
+		found = 1;
+	}
+	lock_release(&pool->injectlock);
+	return found;
+}
+
+/*
+ * Finds a task for a worker: its own newest, then the shared queue,
+ * then the oldest of another worker's, starting from a random one
+ * @param pool The pool
+ * @param w The calling worker
+ * @param t OUTPUT the task
+ * @returns 1 if a task was found, 0 if there seemed to be none
+ */
+static int findtask(struct tpool* pool, struct tpool_worker* w,
+					struct tpool_task* t)
+{
+	int start;
+	struct tpool_worker* v;
+
+	if (dequepop(w, t) || injecttake(pool, t))
+	{
+		return 1;
+	}
+	start = randnext(&w->rand) % pool->nworkers;
+	for (int i = 0; i < pool->nworkers; i++)
+	{
+		v = &pool->workers[(start + i) % pool->nworkers];
+		if (v != w && dequesteal(v, t))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Runs a task and counts it finished, waking tpool_wait() on the last
+ * @param pool The pool
+ * @param t The task
+ */
+static void runtask(struct tpool* pool, struct tpool_task* t)
+{
+	t->fn(t->arg);
+	if (fetch_and_add((int*)&pool->pending, -1) == 1)
+	{
+		futex_wake((int*)&pool->pending, TPOOL_MAXWORKERS + 1);
+	}
+}
+
+/*
+ * Body of each worker thread: runs tasks until there are none, then
+ * sleeps until more are queued or the pool is destroyed
+ * @param ppool The pool
+ * @param pworker This worker
+ */
+static void workermain(void* ppool, void* pworker)
+{
+	struct tpool* pool = (struct tpool*)ppool;
+	struct tpool_worker* w = (struct tpool_worker*)pworker;
+	struct tpool_task t;
+	int seq;
+
+	thread_self()->data = w;
+	for (;;)
+	{
+		if (findtask(pool, w, &t))
+		{
+			runtask(pool, &t);
+			continue;
+		}
+		// Anything queued after this read changes work, so
+		// futex_wait() won't sleep through it.
+		seq = pool->work;
+		if (findtask(pool, w, &t))
+		{
+			runtask(pool, &t);
+			continue;
+		}
+		if (pool->stop)
+		{
+			exit();
+		}
+		fetch_and_add((int*)&pool->nidle, 1);
+		futex_wait((int*)&pool->work, seq);
+		fetch_and_add((int*)&pool->nidle, -1);
+	}
+}
+
+/*
+ * Creates a pool and starts its workers.
+ * @param nworkers Number of worker threads, 1 to TPOOL_MAXWORKERS
+ * @returns the pool, 0 if nworkers is out of range or out of memory
+ * @revisions
+ *   GJE p5  - Created
+ */
+struct tpool* tpool_create(int nworkers)
+{
+	struct tpool* pool;
+
+	if (nworkers < 1 || nworkers > TPOOL_MAXWORKERS)
+	{
+		return 0;
+	}
+	if ((pool = malloc(sizeof(*pool))) == 0)
+	{
+		return 0;
+	}
+	memset(pool, 0, sizeof(*pool));
+	if ((pool->workers = malloc(nworkers * sizeof(*pool->workers))) == 0)
+	{
+		free(pool);
+		return 0;
+	}
+	memset(pool->workers, 0, nworkers * sizeof(*pool->workers));
+	lock_init(&pool->injectlock);
+	pool->nworkers = nworkers;
+	for (int i = 0; i < nworkers; i++)
+	{
+		pool->workers[i].pool = pool;
+		randseed(&pool->workers[i].rand, i + 1);
+	}
+	for (int i = 0; i < nworkers; i++)
+	{
+		if (thread_create(workermain, pool, &pool->workers[i]) < 0)
+		{
+			// Run with the workers we got; their deques are the
+			// only ones anybody will push to or steal from.
+			pool->nworkers = i;
+			break;
+		}
+	}
+	if (pool->nworkers == 0)
+	{
+		free(pool->workers);
+		free(pool);
+		return 0;
+	}
+	return pool;
+}
+
+/*
+ * Queues fn(arg) to run on one of the pool's workers. A worker's own
+ * submissions go on its deque, everyone else's on the shared queue.
+ * If the queue is full the caller runs the task itself.
+ * @param pool The pool
+ * @param fn The task
+ * @param arg Passed to fn
+ * @revisions
+ *   GJE p5  - Created
+ */
+void tpool_submit(struct tpool* pool, void (*fn)(void*), void* arg)
+{
+	struct tpool_worker* w = tpool_self(pool);
+	struct tpool_task t;
+	int queued = 0;
+
+	fetch_and_add((int*)&pool->pending, 1);
+	if (w != 0)
+	{
+		queued = dequepush(w, fn, arg) == 0;
+	}
+	else
+	{
+		lock_acquire(&pool->injectlock);
+		if (pool->injectbottom - pool->injecttop < TPOOL_DEQUE)
+		{
+			t.fn = fn;
+			t.arg = arg;
+			pool->inject[pool->injectbottom & DEQUE_MASK] = t;
+			pool->injectbottom++;
+			queued = 1;
+		}
+		lock_release(&pool->injectlock);
+	}
+
+	if (!queued)
+	{
+		t.fn = fn;
+		t.arg = arg;
+		runtask(pool, &t);
+		return;
+	}
+	fetch_and_add((int*)&pool->work, 1);
+	if (pool->nidle > 0)
+	{
+		futex_wake((int*)&pool->work, 1);
+	}
+}
+
+/*
+ * Waits until every task submitted so far, and every task those
+ * submitted, has finished. Not to be called from inside a task.
+ * @param pool The pool
+ * @revisions
+ *   GJE p5  - Created
+ */
+void tpool_wait(struct tpool* pool)
+{
+	int n;
+
+	while ((n = pool->pending) != 0)
+	{
+		futex_wait((int*)&pool->pending, n);
+	}
+}
+
+/*
+ * Stops the workers once the queues are empty, joins them and frees
+ * the pool. The caller should have no threads of its own to join.
+ * @param pool The pool
+ * @revisions
+ *   GJE p5  - Created
+ */
+void tpool_destroy(struct tpool* pool)
+{
+	tpool_wait(pool);
+	pool->stop = 1;
+	fetch_and_add((int*)&pool->work, 1);
+	futex_wake((int*)&pool->work, pool->nworkers);
+	for (int i = 0; i < pool->nworkers; i++)
+	{
+		thread_join();
+	}
+	free(pool->workers);
+	free(pool);
+}
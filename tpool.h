@@ -0,0 +1,55 @@
+/*
+ * Thread pool: a fixed set of workers running submitted tasks, each
+ * worker with its own deque of tasks that idle workers steal from
+ * 
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#ifndef _TPOOL_H_
+#define _TPOOL_H_
+
+// Most workers a pool can have
+#define TPOOL_MAXWORKERS (16)
+// Tasks a worker's deque holds; a power of two
+#define TPOOL_DEQUE (512)
+
+struct tpool_task
+{
+	void (*fn)(void*);
+	void* arg;
+};
+
+// A Chase-Lev deque: the owning worker pushes and pops at bottom,
+// thieves take from top with a compare and swap.
+struct tpool_worker
+{
+	struct tpool* pool;
+	volatile int top;
+	volatile int bottom;
+	volatile struct tpool_task tasks[TPOOL_DEQUE];
+	uint64 rand;               // Where this worker looks to steal
+};
+
+struct tpool
+{
+	int nworkers;
+	struct tpool_worker* workers;
+	lock_t injectlock;         // Guards inject, for non-worker submitters
+	int injecttop;
+	int injectbottom;
+	struct tpool_task inject[TPOOL_DEQUE];
+	volatile int pending;      // Tasks submitted and not yet finished
+	volatile int work;         // Bumped when a task is queued; idle futex
+	volatile int nidle;        // Workers asleep on work
+	volatile int stop;
+};
+
+struct tpool* tpool_create(int nworkers);
+void tpool_submit(struct tpool* pool, void (*fn)(void*), void* arg);
+void tpool_wait(struct tpool* pool);
+void tpool_destroy(struct tpool* pool);
+
+#endif // _TPOOL_H_
@@ -7,12 +7,15 @@
 #include "x86.h"
 #include "traps.h"
 #include "spinlock.h"
+#include "sleeplock.h"
+#include "mm.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
 struct spinlock tickslock;
 uint ticks;
+uint64 nexttick;  // TSC deadline of the next clock tick, kept by cpu 0
 
 void
 tvinit(void)
@@ -24,6 +27,7 @@ tvinit(void)
   SETGATE(idt[T_SYSCALL], 1, SEG_KCODE<<3, vectors[T_SYSCALL], DPL_USER);
 
   initlock(&tickslock, "time");
+  nexttick = rdtsc() + (uint64)TICKUS * tscperus;
 }
 
 void
@@ -36,6 +40,11 @@ idtinit(void)
 void
 trap(struct trapframe *tf)
 {
+  // Time up to a trap from user mode is user time; from there to
+  // the return to user mode is system time.
+  if((tf->cs&3) == DPL_USER)
+    cpuacct(1);
+
   if(tf->trapno == T_SYSCALL){
     if(myproc()->killed)
       exit();
@@ -43,15 +52,27 @@ trap(struct trapframe *tf)
     syscall();
     if(myproc()->killed)
       exit();
+    cpuacct(0);
     return;
   }
 
+  if(tf->trapno >= T_IRQ0 && tf->trapno < T_IRQ0 + 32)
+    mycpu()->nintr++;
+
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    mycpu()->ntimer++;
     if(cpuid() == 0){
+      // The timer is one-shot and also fires for quantum ends,
+      // so count only the ticks whose deadline has passed.
       acquire(&tickslock);
-      ticks++;
-      wakeup(&ticks);
+      if(rdtsc() >= nexttick){
+        do {
+          ticks++;
+          nexttick += (uint64)TICKUS * tscperus;
+        } while(rdtsc() >= nexttick);
+        wakeup(&ticks);
+      }
       release(&tickslock);
     }
     lapiceoi();
@@ -60,6 +81,15 @@ trap(struct trapframe *tf)
     ideintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Brings a halted cpu back into scheduler(), or tells a busy one
+    // its quantum was cut short; see below.
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_TLBFLUSH:
+    tlbflushintr();
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE+1:
     // Bochs generates spurious IDE1 interrupts.
     break;
@@ -78,6 +108,16 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // A heap page sbrk() reserved but nobody touched yet, or a write
+    // to a copy-on-write page. The kernel may fault too when touching
+    // user memory, unless it holds a spinlock, as uvmfault() can
+    // sleep; system calls fault their buffers in beforehand.
+    if(myproc() && rcr2() < KERNBASE &&
+       ((tf->cs&3) == DPL_USER || mycpu()->ncli == 0) &&
+       uvmfault(myproc()->mm, rcr2(), 1, tf->err & FEC_WR) == 0)
+      break;
+    // Not ours to fix: a real fault.
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -100,13 +140,22 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU when its quantum is over.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     (tf->trapno == T_IRQ0+IRQ_TIMER || tf->trapno == T_IRQ0+IRQ_RESCHED) &&
+     rdtsc() >= mycpu()->qend)
     yield();
 
+  // The timer is one-shot: arm it for this cpu's next event, which
+  // another cpu may have moved closer before sending IRQ_RESCHED.
+  if(tf->trapno == T_IRQ0+IRQ_TIMER || tf->trapno == T_IRQ0+IRQ_RESCHED)
+    timerset();
+
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
+
+  if((tf->cs&3) == DPL_USER)
+    cpuacct(0);
 }
@@ -34,5 +34,7 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_RESCHED     20      // IPI: new work queued for a halted cpu
+#define IRQ_TLBFLUSH    21      // IPI: page table entries changed under us
 #define IRQ_SPURIOUS    31
 
@@ -1,6 +1,8 @@
 /*
  * @revisions
  *   GJE p4b - Add thread and mutex lock library functions
+ *   GJE p5  - Mutex sleeps on a futex when contended
+ *           - Threads get a thread_t reachable through %gs
  */
 
 #include "types.h"
@@ -10,6 +12,8 @@
 #include "x86.h"
 
 #define PGSIZE (4096)
+// Tries at the lock before sleeping on it
+#define LOCK_SPINS (100)
 
 char*
 strcpy(char *s, const char *t)
@@ -121,11 +125,16 @@ memmove(void *vdst, const void *vsrc, int n)
  * @returns pid of created process if successful, -1 otherwise
  * @revisions
  *   GJE p4b - Created
+ *   GJE p5  - Keep the thread's thread_t at the bottom of its stack
  */
 int thread_create(void (*start_routine)(void*, void*), void* arg1, void* arg2)
 {
 	char* stack = malloc(PGSIZE);
-	return clone(start_routine, arg1, arg2, stack);
+	thread_t* self = (thread_t*)stack;
+
+	self->self = self;
+	self->data = 0;
+	return clone(start_routine, arg1, arg2, stack, self);
 }
 
 /*
@@ -142,40 +151,83 @@ int thread_join(void)
 	return pid;
 }
 
+/*
+ * Finds the calling thread's thread_t.
+ * @returns the thread_t given to clone(), or 0 in a thread with no
+ *          thread-local storage (e.g. the main thread)
+ * @revisions
+ *   GJE p5  - Created
+ */
+thread_t* thread_self(void)
+{
+	ushort gs;
+	thread_t* self;
+
+	asm volatile("movw %%gs, %0" : "=r" (gs));
+	if (gs == 0)
+		return 0;
+	asm volatile("movl %%gs:0, %0" : "=r" (self));
+	return self;
+}
+
 /*
  * Initializer for lock.
  * @param plock pointer to lock to initialize
  * @revisions
  *   GJE p4b - Created. Implementation: OSTEP, Arpaci-Dusseau.
+ *   GJE p5  - Single futex state word
  */
 void lock_init(lock_t* plock)
 {
-	plock->ticket = 0;
-	plock->turn = 0;
+	plock->state = 0;
 }
 
 /*
- * Returns with exclusive possession of the lock
+ * Returns with exclusive possession of the lock. Spins briefly, then
+ * marks the lock contended and sleeps in the kernel until released.
  * @param plock pointer to the lock
  * @revisions
  *   GJE p4b - Created. Implementation: OSTEP, Arpaci-Dusseau.
+ *   GJE p5  - Sleep on a futex instead of yielding. Implementation:
+ *             "Futexes Are Tricky", U. Drepper, mutex #3.
  */
 void lock_acquire(lock_t* plock)
 {
-	int myturn = fetch_and_add(&plock->ticket, 1);
-	while (plock->turn != myturn)
+	int c = 0;
+
+	for (int i = 0; i < LOCK_SPINS; i++)
 	{
-		yield();
+		if ((c = cmpxchg(&plock->state, 0, 1)) == 0)
+		{
+			return;
+		}
+		asm volatile("pause");
+	}
+
+	// Whoever holds the lock now has to wake someone on release.
+	if (c != 2)
+	{
+		c = xchg((volatile uint*)&plock->state, 2);
+	}
+	while (c != 0)
+	{
+		futex_wait((int*)&plock->state, 2);
+		c = xchg((volatile uint*)&plock->state, 2);
 	}
 }
 
 /*
- * Release the held lock
+ * Release the held lock, waking a sleeping waiter if there may be one
  * @param plock pointer to lock to release
  * @revisions
  *   GJE p4b - Created. Implementation: OSTEP, Arpaci-Dusseau.
+ *   GJE p5  - Wake a futex waiter if the lock was contended
  */
 void lock_release(lock_t* plock)
 {
-	plock->turn++;
+	if (fetch_and_add((int*)&plock->state, -1) != 1)
+	{
+		plock->state = 0;
+		futex_wake((int*)&plock->state, 1);
+	}
 }
@@ -10,11 +10,23 @@
  *   GJE p4b - add clone system call
  *           - add join system call
  *           - add thread and mutex lock library functions
+ *   GJE p5  - add setsched system call
+ *           - add setquantum system call
+ *           - add getkstat system call
+ *           - getpinfo takes the pid to continue after
+ *           - add futex_wait system call
+ *           - add futex_wake system call
+ *           - lock_t sleeps on a futex instead of yielding
+ *           - clone takes a TLS pointer; add thread_self
+ *           - add setaffinity system call
+ *           - add getslabstat system call
  */
 
 struct stat;
 struct rtcdate;
+struct kstat;
 struct pstat;
+struct slabstat;
 
 // system calls
 int fork(void);
@@ -41,12 +53,20 @@ int uptime(void);
 int getppid(void);
 int getreadcount(void);
 int settickets(int);
-int getpinfo(struct pstat*);
+int getpinfo(int, struct pstat*);
 int yield(void);
 int mprotect(void*, int);
 int munprotect(void*, int);
-int clone(void (*fcn)(void*, void*), void* arg1, void* arg2, void* stack);
+int clone(void (*fcn)(void*, void*), void* arg1, void* arg2, void* stack,
+		  void* tls);
 int join(void** stack);
+int setsched(int);
+int setquantum(int);
+int getkstat(struct kstat*);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int setaffinity(int, uint);
+int getslabstat(int, struct slabstat*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -64,12 +84,21 @@ int atoi(const char*);
 
 typedef struct __lock_t
 {
-	int ticket;
-	int turn;
+	/* 0 unlocked, 1 locked, 2 locked and threads may be sleeping on it */
+	volatile int state;
 } lock_t;
 
+typedef struct __thread_t
+{
+	/* Points to itself; found at %gs:0 */
+	struct __thread_t* self;
+	/* Free for the thread's own use */
+	void* data;
+} thread_t;
+
 int thread_create(void (*)(void*, void*), void*, void*);
 int thread_join(void);
+thread_t* thread_self(void);
 void lock_init(lock_t* plock);
 void lock_acquire(lock_t* plock);
 void lock_release(lock_t* plock);
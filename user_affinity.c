@@ -0,0 +1,103 @@
+/*
+ * Demo of cpu affinity: runs two cpu-bound children per cpu, each
+ * sweeping its own working set for a few seconds, first free to run
+ * anywhere and then each pinned to one cpu with setaffinity(). Every
+ * child reports how many sweeps it finished and how often it moved
+ * between cpus.
+ *
+ * usage: user_affinity [seconds]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "pstat.h"
+#include "kstat.h"
+
+#define SECONDS (3)
+#define TICKS_PER_SEC (100)
+// Ints in each child's working set: 32KB, to fit in a cpu's cache
+#define WSET (8192)
+
+static int s_wset[WSET];
+
+/*
+ * Sweeps the working set until the deadline, then reports
+ * @param name label for the run
+ * @param deadline uptime() at which to stop
+ */
+void child(char* name, int deadline)
+{
+	struct pstat ps;
+	int sweeps = 0;
+	int pid = getpid();
+
+	while (uptime() < deadline)
+	{
+		for (int i = 0; i < WSET; i++)
+		{
+			s_wset[i] += i;
+		}
+		sweeps++;
+	}
+	if (getpinfo(pid - 1, &ps) == pid)
+	{
+		printf(1, "%s\t%d\t%d\t%d\t%d\n", name, pid, ps.cpu, sweeps,
+			   ps.migrations);
+	}
+	exit();
+}
+
+/*
+ * Forks two children per cpu and waits for them
+ * @param name label for the run
+ * @param ncpu number of cpus
+ * @param pin whether to pin child i to cpu i % ncpu
+ * @param seconds how long the children run
+ */
+void run(char* name, int ncpu, int pin, int seconds)
+{
+	int deadline = uptime() + seconds * TICKS_PER_SEC;
+
+	for (int i = 0; i < 2 * ncpu; i++)
+	{
+		if (fork() == 0)
+		{
+			if (pin && setaffinity(0, 1 << (i % ncpu)) < 0)
+			{
+				printf(1, "user_affinity: setaffinity failed\n");
+			}
+			child(name, deadline);
+		}
+	}
+	for (int i = 0; i < 2 * ncpu; i++)
+	{
+		wait();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	struct kstat k;
+	int seconds = SECONDS;
+
+	if (argc > 1 && (seconds = atoi(argv[1])) <= 0)
+	{
+		printf(2, "usage: user_affinity [seconds]\n");
+		exit();
+	}
+	if (getkstat(&k) < 0)
+	{
+		printf(1, "Error:user_affinity.c: Could not get kernel counters\n");
+		exit();
+	}
+
+	printf(1, "run\tpid\tcpu\tsweeps\tmoves\n");
+	run("free", k.ncpu, 0, seconds);
+	run("pinned", k.ncpu, 1, seconds);
+	exit();
+}
@@ -0,0 +1,173 @@
+/*
+ * Checks and times copy-on-write fork. With a growing heap, measures
+ * fork/exit/wait when the child touches nothing, and again when the
+ * child writes every heap page, so each page is copied on a fault.
+ * Also checks that parent and child never see each other's writes,
+ * and that a page made read-only with mprotect() stays read-only.
+ *
+ * usage: user_cow [rounds]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+
+#define PGSIZE (4096)
+#define NROUNDS (50)
+
+static int s_pages[] = {0, 64, 256, 1024};
+
+/*
+ * Writes one byte in each page of a range
+ * @param mem start of the range
+ * @param npages number of pages
+ * @param c byte to write
+ */
+void touch(char* mem, int npages, char c)
+{
+	for (int i = 0; i < npages; i++)
+	{
+		mem[i * PGSIZE] = c;
+	}
+}
+
+/*
+ * Forks children that optionally write every page, and waits for each
+ * @param mem heap pages shared with the children
+ * @param npages number of pages
+ * @param dirty nonzero if the children write the pages
+ * @param rounds number of children
+ * @returns average cycles per fork/exit/wait, -1 on error
+ */
+int forkwait(char* mem, int npages, int dirty, int rounds)
+{
+	uint64 start;
+	int pid;
+
+	start = rdtsc();
+	for (int i = 0; i < rounds; i++)
+	{
+		pid = fork();
+		if (pid < 0)
+		{
+			return -1;
+		}
+		if (pid == 0)
+		{
+			if (dirty)
+			{
+				touch(mem, npages, 'c');
+			}
+			exit();
+		}
+		wait();
+	}
+	return (uint)(rdtsc() - start) / rounds;
+}
+
+/*
+ * Parent and child each write a shared page after fork; neither may
+ * see the other's byte. Exits the program on failure.
+ * @param mem a heap page
+ */
+void checkprivate(char* mem)
+{
+	int fd[2];
+	char c;
+	int pid;
+
+	mem[0] = 'a';
+	if (pipe(fd) < 0 || (pid = fork()) < 0)
+	{
+		printf(2, "user_cow: pipe/fork failed\n");
+		exit();
+	}
+	if (pid == 0)
+	{
+		close(fd[1]);
+		mem[0] = 'b';
+		read(fd[0], &c, 1);
+		if (mem[0] != 'b')
+		{
+			printf(2, "user_cow: child saw parent's write\n");
+		}
+		exit();
+	}
+	close(fd[0]);
+	mem[0] = 'p';
+	// kernel writes into a copy-on-write buffer must unshare it too
+	write(fd[1], "x", 1);
+	close(fd[1]);
+	wait();
+	if (mem[0] != 'p')
+	{
+		printf(2, "user_cow: FAILED parent saw child's write\n");
+		exit();
+	}
+	printf(1, "private writes ok\n");
+}
+
+/*
+ * A page protected before fork must still fault in the child on write
+ * @param page page aligned heap page
+ */
+void checkprotect(char* page)
+{
+	int pid;
+
+	page[0] = 'a';
+	if (mprotect(page, 1) < 0)
+	{
+		printf(2, "user_cow: mprotect failed\n");
+		exit();
+	}
+	pid = fork();
+	if (pid == 0)
+	{
+		page[0] = 'b';
+		printf(2, "user_cow: FAILED write to protected page\n");
+		exit();
+	}
+	wait();
+	munprotect(page, 1);
+	page[0] = 'c';
+	printf(1, "protected page ok\n");
+}
+
+int main(int argc, char* argv[])
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : NROUNDS;
+	int maxpages = s_pages[sizeof(s_pages) / sizeof(s_pages[0]) - 1];
+	char* mem;
+
+	if (rounds <= 0)
+	{
+		printf(2, "usage: user_cow [rounds]\n");
+		exit();
+	}
+	mem = sbrk((maxpages + 1) * PGSIZE);
+	if (mem == (char*)-1)
+	{
+		printf(2, "user_cow: sbrk failed\n");
+		exit();
+	}
+	mem = (char*)(((uint)mem + PGSIZE - 1) & ~(PGSIZE - 1));
+	touch(mem, maxpages, 'p');
+
+	checkprivate(mem);
+	checkprotect(mem);
+
+	printf(1, "pages\tno write\twrite all\t(cycles per fork+exit+wait)\n");
+	for (int i = 0; i < sizeof(s_pages) / sizeof(s_pages[0]); i++)
+	{
+		printf(1, "%d\t%d\t\t%d\n", s_pages[i],
+			   forkwait(mem, s_pages[i], 0, rounds),
+			   forkwait(mem, s_pages[i], 1, rounds));
+	}
+	exit();
+}
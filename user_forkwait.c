@@ -0,0 +1,110 @@
+/*
+ * Measures fork/exit/wait latency, in cycles, while a growing number
+ * of other processes are alive (blocked reading a pipe), to show how
+ * process management scales with the size of the process table.
+ *
+ * usage: user_forkwait [rounds]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+
+#define NROUNDS (200)
+
+static int s_live[] = {0, 16, 64, 256, 512};
+
+/*
+ * Forks children that block until the write end of fd is closed
+ * @param fd pipe the children read from
+ * @param n number of children
+ * @returns number of children started
+ */
+int startSleepers(int* fd, int n)
+{
+	char c;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		int pid = fork();
+		if (pid < 0)
+		{
+			break;
+		}
+		if (pid == 0)
+		{
+			close(fd[1]);
+			read(fd[0], &c, 1);
+			exit();
+		}
+	}
+	return i;
+}
+
+/*
+ * Forks children that exit right away and waits for each
+ * @param rounds number of children
+ * @returns average cycles per fork/exit/wait, -1 on error
+ */
+int forkwait(int rounds)
+{
+	uint64 start;
+	uint cycles;
+	int pid;
+
+	start = rdtsc();
+	for (int i = 0; i < rounds; i++)
+	{
+		pid = fork();
+		if (pid < 0)
+		{
+			return -1;
+		}
+		if (pid == 0)
+		{
+			exit();
+		}
+		wait();
+	}
+	cycles = (uint)(rdtsc() - start);
+	return cycles / rounds;
+}
+
+int main(int argc, char* argv[])
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : NROUNDS;
+	int fd[2];
+	int live;
+
+	if (rounds <= 0)
+	{
+		printf(2, "usage: user_forkwait [rounds]\n");
+		exit();
+	}
+
+	printf(1, "live\tcycles/fork+exit+wait\n");
+	for (int i = 0; i < sizeof(s_live) / sizeof(s_live[0]); i++)
+	{
+		if (pipe(fd) < 0)
+		{
+			printf(2, "user_forkwait: pipe failed\n");
+			exit();
+		}
+		live = startSleepers(fd, s_live[i]);
+		printf(1, "%d\t%d\n", live, forkwait(rounds));
+
+		close(fd[0]);
+		close(fd[1]);
+		for (int j = 0; j < live; j++)
+		{
+			wait();
+		}
+	}
+	exit();
+}
@@ -0,0 +1,86 @@
+/*
+ * Reports timer and total interrupts per second taken by each cpu while
+ * a number of processes spin, optionally with a different quantum.
+ * With the one-shot timer, idle cpus other than cpu 0 should take none
+ * and a cpu with a single process only one per balance interval.
+ *
+ * usage: user_intr [spinners] [quantum_us] [seconds]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "kstat.h"
+
+#define TICKS_PER_SEC (1000000 / TICKUS)
+#define MAX_SPINNERS (16)
+
+int main(int argc, char* argv[])
+{
+	int spinners = argc > 1 ? atoi(argv[1]) : 0;
+	int quantum = argc > 2 ? atoi(argv[2]) : 0;
+	int seconds = argc > 3 ? atoi(argv[3]) : 2;
+	int pids[MAX_SPINNERS];
+	struct kstat before;
+	struct kstat after;
+	uint elapsed;
+	int old = -1;
+	int i;
+
+	if (spinners < 0 || spinners > MAX_SPINNERS || seconds <= 0)
+	{
+		printf(2, "usage: user_intr [spinners] [quantum_us] [seconds]\n");
+		exit();
+	}
+	if (quantum > 0 && (old = setquantum(quantum)) < 0)
+	{
+		printf(2, "user_intr: bad quantum %d\n", quantum);
+		exit();
+	}
+
+	for (i = 0; i < spinners; i++)
+	{
+		pids[i] = fork();
+		if (pids[i] == 0)
+		{
+			for (;;)
+				;
+		}
+	}
+
+	getkstat(&before);
+	sleep(seconds * TICKS_PER_SEC);
+	getkstat(&after);
+
+	for (i = 0; i < spinners; i++)
+	{
+		if (pids[i] > 0)
+		{
+			kill(pids[i]);
+			wait();
+		}
+	}
+	if (old > 0)
+	{
+		setquantum(old);
+	}
+
+	elapsed = after.ticks - before.ticks;
+	if (elapsed == 0)
+	{
+		elapsed = 1;
+	}
+	printf(1, "%d spinners over %d ticks\n", spinners, elapsed);
+	printf(1, "cpu\ttimer/s\tintr/s\n");
+	for (i = 0; i < after.ncpu; i++)
+	{
+		printf(1, "%d\t%d\t%d\n", i,
+			(after.timerintr[i] - before.timerintr[i]) * TICKS_PER_SEC / elapsed,
+			(after.intr[i] - before.intr[i]) * TICKS_PER_SEC / elapsed);
+	}
+	exit();
+}
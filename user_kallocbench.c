@@ -0,0 +1,114 @@
+/*
+ * Stress benchmark for the page allocator. For 1 up to ncpu processes,
+ * each pinned to its own cpu, every process repeatedly grows its heap
+ * by NPAGES pages, touches them so each is allocated on the fault, and
+ * shrinks it again to free them. Reports aggregate pages allocated and
+ * freed per 2^20 cycles; with per-cpu page caches it should grow with
+ * the process count. Run with CPUS=1..8 to compare machines too.
+ *
+ * usage: user_kallocbench [rounds per process]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "kstat.h"
+#include "x86.h"
+
+#define PGSIZE (4096)
+#define NPAGES (16)
+#define NROUNDS (2000)
+
+/*
+ * Allocates and frees NPAGES heap pages per round
+ * @param rounds number of rounds
+ */
+void churn(int rounds)
+{
+	char* mem;
+
+	for (int i = 0; i < rounds; i++)
+	{
+		if ((mem = sbrk(NPAGES * PGSIZE)) == (char*)-1)
+		{
+			printf(2, "user_kallocbench: sbrk failed\n");
+			exit();
+		}
+		for (int j = 0; j < NPAGES; j++)
+		{
+			mem[j * PGSIZE] = 1;
+		}
+		sbrk(-NPAGES * PGSIZE);
+	}
+}
+
+/*
+ * Runs nproc churning processes at once, one per cpu
+ * @param nproc number of processes
+ * @param rounds rounds per process
+ * @returns pages per 2^20 cycles, all processes together
+ */
+uint run(int nproc, int rounds)
+{
+	int fd[2];
+	char c;
+	uint64 start;
+	uint kcycles;
+
+	if (pipe(fd) < 0)
+	{
+		printf(2, "user_kallocbench: pipe failed\n");
+		exit();
+	}
+	for (int i = 0; i < nproc; i++)
+	{
+		if (fork() == 0)
+		{
+			setaffinity(0, 1 << i);
+			close(fd[1]);
+			// wait for the others
+			read(fd[0], &c, 1);
+			churn(rounds);
+			exit();
+		}
+	}
+	close(fd[0]);
+	start = rdtsc();
+	close(fd[1]);
+	for (int i = 0; i < nproc; i++)
+	{
+		wait();
+	}
+	kcycles = (uint)((rdtsc() - start) >> 10);
+	return nproc * rounds * NPAGES * 1024 / (kcycles ? kcycles : 1);
+}
+
+int main(int argc, char* argv[])
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : NROUNDS;
+	struct kstat k;
+	uint base;
+	uint rate;
+
+	if (rounds <= 0 || getkstat(&k) < 0)
+	{
+		printf(2, "usage: user_kallocbench [rounds per process]\n");
+		exit();
+	}
+
+	printf(1, "%d cpus, %d pages x %d rounds per process\n", k.ncpu, NPAGES,
+		   rounds);
+	printf(1, "procs\tpages/Mcyc\tspeedup x100\n");
+	base = run(1, rounds);
+	printf(1, "1\t%d\t\t100\n", base);
+	for (int n = 2; n <= k.ncpu; n++)
+	{
+		rate = run(n, rounds);
+		printf(1, "%d\t%d\t\t%d\n", n, rate, base ? rate * 100 / base : 0);
+	}
+	exit();
+}
@@ -0,0 +1,40 @@
+/*
+ * Prints the kernel-wide counters reported by getkstat()
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ *           - print free page blocks by order
+ *           - print zeroed pages
+ */
+
+#include "types.h"
+#include "user.h"
+#include "kstat.h"
+
+int main(void)
+{
+	struct kstat k;
+
+	if (getkstat(&k) < 0)
+	{
+		printf(1, "Error:user_kstat.c: Could not get kernel counters\n");
+		exit();
+	}
+
+	printf(1, "uptime\t%d ticks\n", k.ticks);
+	printf(1, "cpu\ttimer\tintr\n");
+	for (int i = 0; i < k.ncpu; i++)
+	{
+		printf(1, "%d\t%d\t%d\n", i, k.timerintr[i], k.intr[i]);
+	}
+	printf(1, "wakeups\t%d issued, %d processes woken\n", k.wakeups, k.woken);
+	printf(1, "order\tfree blocks\n");
+	for (int i = 0; i <= MAXORDER; i++)
+	{
+		printf(1, "%d\t%d\n", i, k.freeblocks[i]);
+	}
+	printf(1, "zeroed\t%d pages\n", k.zeroed);
+	exit();
+}
@@ -0,0 +1,107 @@
+/*
+ * Measures scheduler wakeup latency with a pipe ping-pong between two
+ * processes, and process creation latency with fork/exit/wait, in
+ * cycles. Run with different CPUS= to see the cost of idle cpus.
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+
+#define NROUNDS (2000)
+#define NFORKS (200)
+
+/*
+ * Bounces a byte between parent and child over a pair of pipes
+ * @returns average cycles per round trip, -1 on error
+ */
+int pingpong(void)
+{
+	int ping[2];
+	int pong[2];
+	char c = 0;
+	uint64 start;
+	uint cycles;
+	int pid;
+
+	if (pipe(ping) < 0 || pipe(pong) < 0)
+	{
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0)
+	{
+		return -1;
+	}
+	if (pid == 0)
+	{
+		for (int i = 0; i < NROUNDS; i++)
+		{
+			if (read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1)
+			{
+				break;
+			}
+		}
+		exit();
+	}
+
+	start = rdtsc();
+	for (int i = 0; i < NROUNDS; i++)
+	{
+		if (write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1)
+		{
+			kill(pid);
+			wait();
+			return -1;
+		}
+	}
+	cycles = (uint)(rdtsc() - start);
+	wait();
+
+	close(ping[0]);
+	close(ping[1]);
+	close(pong[0]);
+	close(pong[1]);
+	return cycles / NROUNDS;
+}
+
+/*
+ * Forks children that exit right away and waits for each
+ * @returns average cycles per fork/exit/wait, -1 on error
+ */
+int forkwait(void)
+{
+	uint64 start;
+	uint cycles;
+	int pid;
+
+	start = rdtsc();
+	for (int i = 0; i < NFORKS; i++)
+	{
+		pid = fork();
+		if (pid < 0)
+		{
+			return -1;
+		}
+		if (pid == 0)
+		{
+			exit();
+		}
+		wait();
+	}
+	cycles = (uint)(rdtsc() - start);
+	return cycles / NFORKS;
+}
+
+int main(void)
+{
+	printf(1, "pipe round trip:\t%d cycles\n", pingpong());
+	printf(1, "fork/exit/wait:\t\t%d cycles\n", forkwait());
+	exit();
+}
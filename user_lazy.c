@@ -0,0 +1,113 @@
+/*
+ * Checks and times lazy heap allocation. sbrk() only reserves address
+ * space; pages are zeroed and mapped the first time they're touched,
+ * by this process, a child sharing them, another thread, or the
+ * kernel filling a buffer for a system call.
+ *
+ * usage: user_lazy [pages]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+
+#define PGSIZE (4096)
+#define NPAGES (1024)
+
+static char* s_mem;
+static volatile int s_seen;
+
+/*
+ * Exits the program with a message if a check failed
+ * @param ok nonzero if the check passed
+ * @param what the check
+ */
+void check(int ok, char* what)
+{
+	if (!ok)
+	{
+		printf(2, "user_lazy: FAILED %s\n", what);
+		exit();
+	}
+}
+
+/*
+ * Thread body: reads and writes a page nobody has touched yet
+ * @param arg1 the page
+ * @param arg2 Ignored
+ */
+void toucher(void* arg1, void* arg2)
+{
+	char* page = arg1;
+
+	s_seen = page[100];
+	page[100] = 't';
+	exit();
+}
+
+int main(int argc, char* argv[])
+{
+	int npages = argc > 1 ? atoi(argv[1]) : NPAGES;
+	uint64 start;
+	uint reserve;
+	uint touch;
+	int fd[2];
+	char* top;
+
+	if (npages <= 4)
+	{
+		printf(2, "usage: user_lazy [pages > 4]\n");
+		exit();
+	}
+
+	start = rdtsc();
+	s_mem = sbrk(npages * PGSIZE);
+	reserve = (uint)(rdtsc() - start);
+	check(s_mem != (char*)-1, "sbrk");
+
+	start = rdtsc();
+	for (int i = 0; i < npages; i++)
+	{
+		check(s_mem[i * PGSIZE + 1] == 0, "fresh page is zero");
+	}
+	touch = (uint)(rdtsc() - start);
+	printf(1, "%d pages: sbrk %d cycles, first touch %d cycles/page\n",
+		   npages, reserve, touch / npages);
+
+	// A thread faults in a page of the shared address space
+	s_seen = -1;
+	thread_create(toucher, s_mem + npages * PGSIZE - PGSIZE / 2, 0);
+	thread_join();
+	check(s_seen == 0 && s_mem[npages * PGSIZE - PGSIZE / 2 + 100] == 't',
+		  "page touched by a thread");
+
+	// The kernel writes into a page not yet allocated
+	top = sbrk(2 * PGSIZE);
+	check(pipe(fd) == 0 && write(fd[1], "lazy", 5) == 5, "pipe write");
+	check(read(fd[0], top + PGSIZE, 5) == 5 && strcmp(top + PGSIZE, "lazy") == 0,
+		  "read into untouched page");
+	close(fd[0]);
+	close(fd[1]);
+
+	// A child forked before the pages are touched gets its own
+	if (fork() == 0)
+	{
+		check(top[0] == 0, "child page is zero");
+		top[0] = 'c';
+		exit();
+	}
+	wait();
+	check(top[0] == 0, "child's page is private");
+
+	// Shrinking frees only what was touched, and growing again is zeroed
+	sbrk(-2 * PGSIZE);
+	top = sbrk(2 * PGSIZE);
+	check(top[PGSIZE] == 0, "regrown page is zero");
+	printf(1, "user_lazy: ok\n");
+	exit();
+}
@@ -0,0 +1,152 @@
+/*
+ * Benchmark for the thread mutex: NTHREADS threads increment a shared
+ * counter under a lock, as test_threads1 does, first with the old
+ * ticket lock that yields while waiting and then with lock_t, which
+ * sleeps on a futex. Reports throughput and the cpu time the threads
+ * burned doing it.
+ *
+ * usage: user_lockbench [increments per thread]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "pstat.h"
+#include "x86.h"
+
+#define NTHREADS (4)
+#define INC_TIMES (10000)
+#define MS_PER_TICK (10)
+
+/* the lock_t of p4b: a ticket lock that yields until its turn comes */
+typedef struct __yieldlock_t
+{
+	int ticket;
+	int turn;
+} yieldlock_t;
+
+static volatile int s_counter = 0;
+static volatile int s_done = 0;
+static int s_increments = INC_TIMES;
+
+void yieldlock_acquire(yieldlock_t* plock)
+{
+	int myturn = fetch_and_add(&plock->ticket, 1);
+	while (plock->turn != myturn)
+	{
+		yield();
+	}
+}
+
+void yieldlock_release(yieldlock_t* plock)
+{
+	plock->turn++;
+}
+
+/*
+ * Increments s_counter under a yielding ticket lock
+ * @param plock pointer to yieldlock_t
+ * @param arg2 Ignored
+ */
+void yieldWorker(void* plock, void* arg2)
+{
+	for (int i = 0; i < s_increments; i++)
+	{
+		yieldlock_acquire((yieldlock_t*)plock);
+		s_counter++;
+		yieldlock_release((yieldlock_t*)plock);
+	}
+	fetch_and_add((int*)&s_done, 1);
+	exit();
+}
+
+/*
+ * Increments s_counter under a futex mutex
+ * @param plock pointer to lock_t
+ * @param arg2 Ignored
+ */
+void futexWorker(void* plock, void* arg2)
+{
+	for (int i = 0; i < s_increments; i++)
+	{
+		lock_acquire((lock_t*)plock);
+		s_counter++;
+		lock_release((lock_t*)plock);
+	}
+	fetch_and_add((int*)&s_done, 1);
+	exit();
+}
+
+/*
+ * Runs NTHREADS workers to completion and prints their figures
+ * @param name label for the lock
+ * @param worker thread routine
+ * @param plock lock passed to the workers
+ */
+void run(char* name, void (*worker)(void*, void*), void* plock)
+{
+	int pid[NTHREADS];
+	struct pstat pstat;
+	uint64 start;
+	uint cycles;
+	int ticks;
+	int cpums = 0;
+	int total = NTHREADS * s_increments;
+
+	s_counter = 0;
+	s_done = 0;
+	ticks = uptime();
+	start = rdtsc();
+	for (int i = 0; i < NTHREADS; i++)
+	{
+		pid[i] = thread_create(worker, plock, 0);
+	}
+	while (s_done < NTHREADS)
+	{
+		sleep(1);
+	}
+	cycles = (uint)(rdtsc() - start);
+	ticks = uptime() - ticks;
+
+	// The threads are zombies until joined, so their times are still there.
+	for (int i = 0; i < NTHREADS; i++)
+	{
+		if (pid[i] > 0 && getpinfo(pid[i] - 1, &pstat) == pid[i])
+		{
+			cpums += (pstat.utime + pstat.stime) / 1000;
+		}
+	}
+	for (int i = 0; i < NTHREADS; i++)
+	{
+		if (pid[i] > 0)
+		{
+			thread_join();
+		}
+	}
+
+	printf(1, "%s\t%d\t%d\t%d\t%d\n", name, cycles / total,
+		   ticks * MS_PER_TICK, cpums, s_counter == total);
+}
+
+int main(int argc, char* argv[])
+{
+	yieldlock_t ylock = {0, 0};
+	lock_t lock;
+
+	if (argc > 1 && (s_increments = atoi(argv[1])) <= 0)
+	{
+		printf(2, "usage: user_lockbench [increments per thread]\n");
+		exit();
+	}
+	lock_init(&lock);
+
+	printf(1, "%d threads x %d increments\n", NTHREADS, s_increments);
+	printf(1, "lock\tcyc/inc\twall ms\tcpu ms\tcorrect\n");
+	run("yield", yieldWorker, &ylock);
+	run("futex", futexWorker, &lock);
+	exit();
+}
@@ -1,83 +1,224 @@
 /*
  * Created three proceses with 10, 20, and 30 tickets respectively
- * and graphs the number of ticks scheduled for each process
+ * and graphs the cpu time, in milliseconds, each process has received
  * to demonstrate the lottery scheduler
  *
+ * With "compare", runs the same workload under the lottery and the
+ * stride scheduler and graphs how far each child's share of the cpu
+ * time strays from its share of the tickets over time.
+ *
  * @author Greg Edwards
  * @version 1.0
  * @revisions
  *   GJE p2b - Created
+ *   GJE p5  - add compare mode for lottery vs stride share error
+ *           - measure cpu time instead of times scheduled
+ *           - look up each child with the getpinfo() iterator
  */
 
 #include "types.h"
 #include "user.h"
 #include "pstat.h"
 #include "rand.h"
+#include "sched.h"
+
+#define NCHILD (3)
+#define NSAMPLES (50)
+
+static int s_tickets[NCHILD] = {10, 20, 30};
 
-#define pstatErrorMsg() "error:lottery.c:could not get process info\n"
-#define GetProcessInfo(pstat) if(getpinfo(&pstat) < 0)\
-							   { printf(1, pstatErrorMsg()); exit(); }
+void startChildren(char* spins, int* pid);
+void stopChildren(int* pid);
+void getCpuTime(int* pid, int* ms);
+int shareError(int* ms);
+void compare(char* spins);
 
 int main(int argc, char** argv)
 {
+	int pid[NCHILD];
+	int ms[NCHILD];
+
+	if (argc == 3 && strcmp(argv[2], "compare") == 0)
+	{
+		compare(argv[1]);
+		exit();
+	}
 	if (argc != 2)
 	{
-		printf(1, "user_lottery.c:usage \"user_lottery spins\"\n");
+		printf(1, "user_lottery.c:usage \"user_lottery spins [compare]\"\n");
 		exit();
 	}
 
-	struct pstat pstat;
-	
+	startChildren(argv[1], pid);
+
+	printf(1, "\tA:%d:%d\tB:%d:%d\tC:%d:%d\n", 
+			pid[0], s_tickets[0],
+			pid[1], s_tickets[1],
+			pid[2], s_tickets[2]);
+
+	for (int k=0; k < NSAMPLES; k++)
+	{
+		getCpuTime(pid, ms);
+		printf(1, "%d", k);
+		for (int i=0; i < NCHILD; i++)
+		{
+			printf(1, "\t%d", ms[i]);
+		}
+		printf(1, "\n");
+		yield();
+	}
+
+	stopChildren(pid);
+	exit();
+}
+
+/*
+ * Runs the workload once per policy and prints the share error of
+ * each over time, in tenths of a percent.
+ * @param spins Iterations for each child to spin
+ * @revisions
+ *   GJE p5  - Created
+ *           - Restore the policy in force before the first pass
+ */
+void compare(char* spins)
+{
+	int policies[] = {SCHED_LOTTERY, SCHED_STRIDE};
+	int err[2][NSAMPLES];
+	int pid[NCHILD];
+	int ms[NCHILD];
+	int old = -1;
+	int prev;
+
+	for (int j=0; j < 2; j++)
+	{
+		if ((prev = setsched(policies[j])) < 0)
+		{
+			printf(1, "error:lottery.c:could not set scheduler\n");
+			exit();
+		}
+		// Put back the policy from before we started, not our own
+		if (j == 0)
+		{
+			old = prev;
+		}
+		startChildren(spins, pid);
+		for (int k=0; k < NSAMPLES; k++)
+		{
+			getCpuTime(pid, ms);
+			err[j][k] = shareError(ms);
+			yield();
+		}
+		stopChildren(pid);
+	}
+	setsched(old);
+
+	printf(1, "max share error (0.1%%)\n\tlottery\tstride\n");
+	for (int k=0; k < NSAMPLES; k++)
+	{
+		printf(1, "%d\t%d\t%d\n", k, err[0][k], err[1][k]);
+	}
+}
+
+/*
+ * Forks the spinning children, each with its share of s_tickets
+ * @param spins Iterations for each child to spin
+ * @param pid OUTPUT pids of the children
+ * @revisions
+ *   GJE p5  - Created from main()
+ */
+void startChildren(char* spins, int* pid)
+{
 	char* pargv[3];
 	pargv[0] = "user_spin";
-	pargv[1] = argv[1];
+	pargv[1] = spins;
 	pargv[2] = 0;
 
-	int n = 3;
-	int tickets[] = {10, 20, 30};
-	int pid[n];
-	for (int i=0; i < n; i++)
+	for (int i=0; i < NCHILD; i++)
 	{
 		pid[i] = fork();
 		if (pid[i] == 0)
 		{
-			settickets(tickets[i]);
+			settickets(s_tickets[i]);
 			exec("user_spin", pargv);
 			exit();
 		}
 	}
 
 	settickets(20);
+}
 
-	printf(1, "\tA:%d:%d\tB:%d:%d\tC:%d:%d\n", 
-			pid[0], tickets[0],
-			pid[1], tickets[1],
-			pid[2], tickets[2]);
-
-	for (int k=0; k < 50; k++)
+/*
+ * Kills and reaps the children started by startChildren()
+ * @revisions
+ *   GJE p5  - Created from main()
+ */
+void stopChildren(int* pid)
+{
+	for (int i=0; i < NCHILD; i++)
 	{
+		kill(pid[i]);
+	}
+	while (wait() != -1) {  }
+}
 
-		GetProcessInfo(pstat);
-		printf(1, "%d", k);
-		for (int i=0; i < n; i++)
+/*
+ * Looks up the cpu time, user and system, each child has received
+ * @param pid pids of the children
+ * @param ms OUTPUT milliseconds of cpu time of each child
+ * @revisions
+ *   GJE p5  - Created from main()
+ *           - Report cpu time instead of times scheduled
+ *           - Look up one pid at a time
+ */
+void getCpuTime(int* pid, int* ms)
+{
+	struct pstat pstat;
+
+	for (int i=0; i < NCHILD; i++)
+	{
+		// The process after pid - 1 is the child, if it still exists.
+		ms[i] = 0;
+		if (getpinfo(pid[i] - 1, &pstat) == pid[i])
 		{
-			for (int j=0; j < NPROC; j++)
-			{
-				if (pstat.pid[j] == pid[i])
-				{
-					printf(1, "\t%d", pstat.ticks[j]);
-					break;
-				}
-			}
+			ms[i] = (pstat.utime + pstat.stime) / 1000;
 		}
-		printf(1, "\n");
-		yield();
 	}
+}
+
+/*
+ * Computes how far the child furthest from its fair share is from it
+ * @param ms cpu time of each child
+ * @returns the largest |time share - ticket share| in tenths of a percent
+ * @revisions
+ *   GJE p5  - Created
+ */
+int shareError(int* ms)
+{
+	int totalTime = 0;
+	int totalTickets = 0;
+	int worst = 0;
+	int err;
 
-	for (int i=0; i < n; i++)
+	for (int i=0; i < NCHILD; i++)
 	{
-		kill(pid[i]);
+		totalTime += ms[i];
+		totalTickets += s_tickets[i];
 	}
-	while (wait() != -1) {  }
-	exit();
+	if (totalTime == 0)
+	{
+		return 0;
+	}
+	for (int i=0; i < NCHILD; i++)
+	{
+		err = 1000 * ms[i] / totalTime - 1000 * s_tickets[i] / totalTickets;
+		if (err < 0)
+		{
+			err = -err;
+		}
+		if (err > worst)
+		{
+			worst = err;
+		}
+	}
+	return worst;
 }
@@ -0,0 +1,121 @@
+/*
+ * Measures the cost and quality of the random number generator in rand.c
+ * (the one each cpu's lottery draws from) against the shared LCG it
+ * replaced.
+ *
+ * Cost is cycles per draw. Quality is the chi-square statistic of the
+ * low bits of single draws (16 buckets, 15 degrees of freedom) and of
+ * consecutive pairs (256 buckets, 255 degrees of freedom); a good
+ * generator lands near the degrees of freedom.
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+#include "rand.h"
+
+#define NDRAWS (1 << 20)
+#define NBUCKETS (16)
+#define CHI_MAX (0x7FFFFFFF)
+
+static uint s_lcgSeed = 999999;
+static uint64 s_pcgState;
+static uint s_buckets[NBUCKETS * NBUCKETS];
+
+typedef uint (*draw_t)(void);
+
+/*
+ * The generator rand0() used before p5
+ */
+uint lcgDraw(void)
+{
+	s_lcgSeed = (0x138D395 * s_lcgSeed + 12345) & 0x7FFFFFFF;
+	return s_lcgSeed;
+}
+
+uint pcgDraw(void)
+{
+	return randnext(&s_pcgState);
+}
+
+/*
+ * Computes the chi-square statistic of the first n buckets
+ * @returns the statistic, saturating at CHI_MAX
+ */
+uint chiSquare(int n, uint draws)
+{
+	uint expected = draws / n;
+	uint chi = 0;
+	uint d;
+
+	for (int i = 0; i < n; i++)
+	{
+		d = s_buckets[i] > expected ? s_buckets[i] - expected
+		                            : expected - s_buckets[i];
+		// d*d overflows past this; the generator is hopeless anyway
+		if (d >= 0xFFFF)
+		{
+			return CHI_MAX;
+		}
+		chi += d * d / expected;
+		if (chi >= CHI_MAX)
+		{
+			return CHI_MAX;
+		}
+	}
+	return chi;
+}
+
+/*
+ * Times a generator and tests the distribution of its low bits
+ */
+void bench(char* name, draw_t draw)
+{
+	uint64 start;
+	uint cycles;
+	uint single, pairs;
+	uint prev, cur;
+	int i;
+
+	start = rdtsc();
+	for (i = 0; i < NDRAWS; i++)
+	{
+		draw();
+	}
+	cycles = (uint)(rdtsc() - start);
+
+	memset(s_buckets, 0, sizeof(s_buckets));
+	for (i = 0; i < NDRAWS; i++)
+	{
+		s_buckets[draw() % NBUCKETS]++;
+	}
+	single = chiSquare(NBUCKETS, NDRAWS);
+
+	memset(s_buckets, 0, sizeof(s_buckets));
+	prev = draw() % NBUCKETS;
+	for (i = 0; i < NDRAWS; i++)
+	{
+		cur = draw() % NBUCKETS;
+		s_buckets[prev * NBUCKETS + cur]++;
+		prev = cur;
+	}
+	pairs = chiSquare(NBUCKETS * NBUCKETS, NDRAWS);
+
+	printf(1, "%s\t%d\t\t%d\t\t%d\n", name, cycles / NDRAWS, single, pairs);
+}
+
+int main(void)
+{
+	randseed(&s_pcgState, rdtsc());
+
+	printf(1, "%d draws\n", NDRAWS);
+	printf(1, "gen\tcycles/draw\tchi2(df=15)\tchi2 pairs(df=255)\n");
+	bench("lcg", lcgDraw);
+	bench("pcg32", pcgDraw);
+	exit();
+}
@@ -0,0 +1,134 @@
+/*
+ * Prints the kernel object caches reported by getslabstat(), then
+ * holds many pipes open at once, as a shell running pipelines does,
+ * and reports the memory the pipe and file caches use for them against
+ * a page per pipe and a fixed NFILE-entry file table.
+ *
+ * usage: user_slab [processes]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "param.h"
+#include "slabstat.h"
+
+#define PGSIZE (4096)
+#define NCHILD (6)
+#define PIPES_PER_CHILD (6)
+#define FILESIZE (24) // sizeof(struct file) in the kernel
+
+/*
+ * Prints every cache
+ */
+void printcaches(void)
+{
+	struct slabstat st;
+
+	printf(1, "cache\tsize\tpages\tobjs\tinuse\tallocs\trefills\n");
+	for (int i = 0; getslabstat(i, &st) == 0; i++)
+	{
+		printf(1, "%s\t%d\t%d\t%d\t%d\t%d\t%d\n", st.name, st.size, st.npages,
+			   st.nobj, st.ninuse, st.nalloc, st.nrefill);
+	}
+}
+
+/*
+ * Finds a cache by name
+ * @param name the cache's name
+ * @param st OUTPUT its figures
+ * @returns 0 if found, -1 otherwise
+ */
+int findcache(char* name, struct slabstat* st)
+{
+	for (int i = 0; getslabstat(i, st) == 0; i++)
+	{
+		if (strcmp(st->name, name) == 0)
+		{
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Opens pipes, says so, and holds them until gate is closed
+ * @param ready pipe to report on
+ * @param gate pipe to wait on
+ */
+void holdpipes(int* ready, int* gate)
+{
+	int fd[2];
+	int n = 0;
+	char c;
+
+	close(ready[0]);
+	close(gate[1]);
+	while (n < PIPES_PER_CHILD && pipe(fd) == 0)
+	{
+		n++;
+	}
+	c = n;
+	write(ready[1], &c, 1);
+	close(ready[1]);
+	read(gate[0], &c, 1);
+	exit();
+}
+
+int main(int argc, char* argv[])
+{
+	int nchild = argc > 1 ? atoi(argv[1]) : NCHILD;
+	int ready[2];
+	int gate[2];
+	int npipes = 0;
+	struct slabstat pipes;
+	struct slabstat files;
+	uint before;
+	uint after;
+	char c;
+
+	if (nchild <= 0 || pipe(ready) < 0 || pipe(gate) < 0)
+	{
+		printf(2, "usage: user_slab [processes]\n");
+		exit();
+	}
+	for (int i = 0; i < nchild; i++)
+	{
+		if (fork() == 0)
+		{
+			holdpipes(ready, gate);
+		}
+	}
+	close(ready[1]);
+	close(gate[0]);
+	for (int i = 0; i < nchild && read(ready[0], &c, 1) == 1; i++)
+	{
+		npipes += c;
+	}
+	npipes += 2; // ready and gate
+
+	printcaches();
+	if (findcache("pipe", &pipes) < 0 || findcache("file", &files) < 0)
+	{
+		printf(2, "user_slab: no pipe or file cache\n");
+	}
+	else
+	{
+		before = npipes * PGSIZE + NFILE * FILESIZE;
+		after = (pipes.npages + files.npages) * PGSIZE;
+		printf(1, "%d pipes open: %d bytes in caches, %d with a page per "
+			   "pipe and a fixed file table, %d saved\n",
+			   npipes, after, before, (int)(before - after));
+	}
+
+	close(gate[1]);
+	for (int i = 0; i < nchild; i++)
+	{
+		wait();
+	}
+	exit();
+}
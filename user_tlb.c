@@ -0,0 +1,119 @@
+/*
+ * Benchmark for TLB shootdown: times mprotect()/munprotect() of a
+ * range of pages, and shrinking the heap with sbrk(), while 0 to
+ * MAXSPIN other threads of the process keep other cpus busy in the
+ * same address space. Each of those cpus must be interrupted to flush
+ * its TLB, once per call however many pages change.
+ *
+ * usage: user_tlb [calls per measurement]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+
+#define PGSIZE (4096)
+#define MAXSPIN (7)
+#define NPAGES (8)
+#define CALLS (1000)
+
+static volatile int s_started = 0;
+static volatile int s_stop = 0;
+static int s_calls = CALLS;
+
+/*
+ * Keeps a cpu running in this address space until told to stop
+ * @param arg1 Ignored
+ * @param arg2 Ignored
+ */
+void spin(void* arg1, void* arg2)
+{
+	fetch_and_add((int*)&s_started, 1);
+	while (!s_stop)
+		;
+	exit();
+}
+
+/*
+ * Cycles per mprotect() plus munprotect() of NPAGES pages
+ * @param pages page aligned range to protect
+ */
+uint timeprotect(char* pages)
+{
+	uint64 start = rdtsc();
+
+	for (int i = 0; i < s_calls; i++)
+	{
+		mprotect(pages, NPAGES);
+		munprotect(pages, NPAGES);
+	}
+	return (uint)(rdtsc() - start) / (2 * s_calls);
+}
+
+/*
+ * Cycles per sbrk() giving back NPAGES pages, not counting the sbrk()
+ * that grew the heap first
+ */
+uint timeshrink(void)
+{
+	uint64 cycles = 0;
+	uint64 start;
+
+	for (int i = 0; i < s_calls; i++)
+	{
+		if (sbrk(NPAGES * PGSIZE) == (char*)-1)
+		{
+			return 0;
+		}
+		start = rdtsc();
+		sbrk(-NPAGES * PGSIZE);
+		cycles += rdtsc() - start;
+	}
+	return (uint)cycles / s_calls;
+}
+
+int main(int argc, char* argv[])
+{
+	char* mem;
+	char* pages;
+	int nspin;
+
+	if (argc > 1 && (s_calls = atoi(argv[1])) <= 0)
+	{
+		printf(2, "usage: user_tlb [calls per measurement]\n");
+		exit();
+	}
+	mem = malloc((NPAGES + 1) * PGSIZE);
+	pages = (char*)(((uint)mem + PGSIZE - 1) & ~(PGSIZE - 1));
+
+	printf(1, "%d pages, %d calls\n", NPAGES, s_calls);
+	printf(1, "threads\tprotect\tshrink\t(cycles per call)\n");
+	for (nspin = 0; nspin <= MAXSPIN; nspin++)
+	{
+		s_started = 0;
+		s_stop = 0;
+		for (int i = 0; i < nspin; i++)
+		{
+			thread_create(spin, 0, 0);
+		}
+		while (s_started < nspin)
+		{
+			sleep(1);
+		}
+
+		printf(1, "%d\t%d\t%d\n", nspin + 1, timeprotect(pages), timeshrink());
+
+		s_stop = 1;
+		for (int i = 0; i < nspin; i++)
+		{
+			thread_join();
+		}
+	}
+	free(mem);
+	exit();
+}
@@ -0,0 +1,238 @@
+/*
+ * Thread pool demo: sums and then sorts an array of random numbers,
+ * once in one thread and once on a pool, and checks the answers agree.
+ * The sum is split into fixed chunks; the sort is a quicksort whose
+ * tasks submit one half of each partition back to the pool, so the
+ * work spreads by stealing.
+ *
+ * usage: user_tpool [workers]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+#include "rand.h"
+#include "tpool.h"
+
+#define NWORKERS (4)
+#define NELEMS (65536)
+#define NCHUNKS (64)
+// Ranges at most this long are sorted without submitting more tasks
+#define CUTOFF (1024)
+#define MAXRANGES (1024)
+
+struct range
+{
+	int lo;
+	int hi;
+};
+
+static struct tpool* s_pool;
+static int* s_data;
+static int s_partial[NCHUNKS];
+static struct range s_ranges[MAXRANGES];
+static volatile int s_nranges = 0;
+
+static void swap(int* a, int i, int j)
+{
+	int t = a[i];
+	a[i] = a[j];
+	a[j] = t;
+}
+
+/*
+ * Partitions a[lo, hi) about its middle element
+ * @returns where the pivot ended up; a[lo, k) < a[k] <= a[k+1, hi)
+ */
+static int partition(int* a, int lo, int hi)
+{
+	int pivot;
+	int k = lo;
+
+	swap(a, lo + (hi - lo) / 2, hi - 1);
+	pivot = a[hi - 1];
+	for (int i = lo; i < hi - 1; i++)
+	{
+		if (a[i] < pivot)
+		{
+			swap(a, i, k++);
+		}
+	}
+	swap(a, k, hi - 1);
+	return k;
+}
+
+/*
+ * Sorts a[lo, hi) in this thread, recursing on the smaller side only
+ * so a worker's one-page stack is enough
+ */
+void sortserial(int* a, int lo, int hi)
+{
+	int k;
+	int v;
+	int j;
+
+	while (hi - lo > 16)
+	{
+		k = partition(a, lo, hi);
+		if (k - lo < hi - k - 1)
+		{
+			sortserial(a, lo, k);
+			lo = k + 1;
+		}
+		else
+		{
+			sortserial(a, k + 1, hi);
+			hi = k;
+		}
+	}
+	for (int i = lo + 1; i < hi; i++)
+	{
+		v = a[i];
+		for (j = i; j > lo && a[j - 1] > v; j--)
+		{
+			a[j] = a[j - 1];
+		}
+		a[j] = v;
+	}
+}
+
+void sorttask(void* prange);
+
+/*
+ * Hands s_data[lo, hi) to the pool to sort
+ * @returns 1 if submitted, 0 if out of range slots
+ */
+static int submitrange(int lo, int hi)
+{
+	int slot = fetch_and_add((int*)&s_nranges, 1);
+
+	if (slot >= MAXRANGES)
+	{
+		return 0;
+	}
+	s_ranges[slot].lo = lo;
+	s_ranges[slot].hi = hi;
+	tpool_submit(s_pool, sorttask, &s_ranges[slot]);
+	return 1;
+}
+
+/*
+ * Partitions its range, giving away the upper part each time, until
+ * what is left is short enough to sort itself
+ * @param prange pointer to struct range
+ */
+void sorttask(void* prange)
+{
+	struct range* r = (struct range*)prange;
+	int lo = r->lo;
+	int hi = r->hi;
+	int k;
+
+	while (hi - lo > CUTOFF)
+	{
+		k = partition(s_data, lo, hi);
+		if (!submitrange(k + 1, hi))
+		{
+			sortserial(s_data, k + 1, hi);
+		}
+		hi = k;
+	}
+	sortserial(s_data, lo, hi);
+}
+
+/*
+ * Sums one NCHUNKS'th of s_data into s_partial
+ * @param pchunk index of the chunk
+ */
+void sumtask(void* pchunk)
+{
+	int chunk = (int)pchunk;
+	int n = NELEMS / NCHUNKS;
+	int sum = 0;
+
+	for (int i = chunk * n; i < (chunk + 1) * n; i++)
+	{
+		sum += s_data[i];
+	}
+	s_partial[chunk] = sum;
+}
+
+int main(int argc, char* argv[])
+{
+	int nworkers = NWORKERS;
+	int* copy;
+	uint64 rand;
+	uint64 start;
+	uint serial;
+	uint pooled;
+	int sum = 0;
+	int poolsum = 0;
+	int sorted = 1;
+
+	if (argc > 1)
+	{
+		nworkers = atoi(argv[1]);
+	}
+	s_data = malloc(NELEMS * sizeof(int));
+	copy = malloc(NELEMS * sizeof(int));
+	if ((s_pool = tpool_create(nworkers)) == 0 || s_data == 0 || copy == 0)
+	{
+		printf(2, "usage: user_tpool [workers, 1 to %d]\n", TPOOL_MAXWORKERS);
+		exit();
+	}
+	randseed(&rand, uptime());
+	for (int i = 0; i < NELEMS; i++)
+	{
+		s_data[i] = randnext(&rand) % 1000000;
+		copy[i] = s_data[i];
+	}
+	printf(1, "%d elements, %d workers\n", NELEMS, nworkers);
+
+	start = rdtsc();
+	for (int i = 0; i < NELEMS; i++)
+	{
+		sum += s_data[i];
+	}
+	serial = (uint)(rdtsc() - start);
+	start = rdtsc();
+	for (int i = 0; i < NCHUNKS; i++)
+	{
+		tpool_submit(s_pool, sumtask, (void*)i);
+	}
+	tpool_wait(s_pool);
+	for (int i = 0; i < NCHUNKS; i++)
+	{
+		poolsum += s_partial[i];
+	}
+	pooled = (uint)(rdtsc() - start);
+	printf(1, "sum\tserial %d cyc\tpool %d cyc\t%s\n", serial, pooled,
+		   sum == poolsum ? "ok" : "WRONG");
+
+	start = rdtsc();
+	sortserial(copy, 0, NELEMS);
+	serial = (uint)(rdtsc() - start);
+	start = rdtsc();
+	submitrange(0, NELEMS);
+	tpool_wait(s_pool);
+	pooled = (uint)(rdtsc() - start);
+	for (int i = 0; i < NELEMS; i++)
+	{
+		if (s_data[i] != copy[i])
+		{
+			sorted = 0;
+		}
+	}
+	printf(1, "sort\tserial %d cyc\tpool %d cyc\t%s (%d tasks)\n", serial,
+		   pooled, sorted ? "ok" : "WRONG", s_nranges);
+
+	tpool_destroy(s_pool);
+	free(copy);
+	free(s_data);
+	exit();
+}
@@ -0,0 +1,123 @@
+/*
+ * Benchmark for the thread pool: runs NTASKS small tasks, each a loop
+ * of some number of iterations, first by submitting them to a pool and
+ * then with a thread_create() and thread_join() per task, at most
+ * nworkers of them alive at once. Reports cycles per task.
+ *
+ * usage: user_tpoolbench [workers]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "x86.h"
+#include "tpool.h"
+
+#define NWORKERS (4)
+#define NTASKS (1000)
+
+static int s_work[] = {0, 1000, 10000, 100000};
+static volatile int s_sink;
+
+/*
+ * A task: burns iterations of a loop
+ * @param piters number of iterations
+ */
+void spintask(void* piters)
+{
+	int n = (int)piters;
+	int x = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		x += i;
+	}
+	s_sink = x;
+}
+
+/*
+ * The same task, as a thread routine
+ * @param piters number of iterations
+ * @param arg2 Ignored
+ */
+void spinthread(void* piters, void* arg2)
+{
+	spintask(piters);
+	exit();
+}
+
+/*
+ * Cycles per task to run NTASKS tasks on a pool
+ */
+uint timepool(struct tpool* pool, int iters)
+{
+	uint64 start = rdtsc();
+
+	for (int i = 0; i < NTASKS; i++)
+	{
+		tpool_submit(pool, spintask, (void*)iters);
+	}
+	tpool_wait(pool);
+	return (uint)(rdtsc() - start) / NTASKS;
+}
+
+/*
+ * Cycles per task to run NTASKS tasks a thread each, nworkers at a time
+ */
+uint timethreads(int nworkers, int iters)
+{
+	uint64 start = rdtsc();
+	int live = 0;
+
+	for (int i = 0; i < NTASKS; i++)
+	{
+		if (live == nworkers)
+		{
+			thread_join();
+			live--;
+		}
+		if (thread_create(spinthread, (void*)iters, 0) > 0)
+		{
+			live++;
+		}
+	}
+	while (live-- > 0)
+	{
+		thread_join();
+	}
+	return (uint)(rdtsc() - start) / NTASKS;
+}
+
+int main(int argc, char* argv[])
+{
+	int nworkers = NWORKERS;
+	struct tpool* pool;
+	uint pool_cyc;
+	uint thread_cyc;
+
+	if (argc > 1)
+	{
+		nworkers = atoi(argv[1]);
+	}
+	if ((pool = tpool_create(nworkers)) == 0)
+	{
+		printf(2, "usage: user_tpoolbench [workers, 1 to %d]\n",
+			   TPOOL_MAXWORKERS);
+		exit();
+	}
+
+	printf(1, "%d tasks, %d workers\n", NTASKS, nworkers);
+	printf(1, "iters\tpool\tthreads\t(cycles per task)\n");
+	for (int i = 0; i < sizeof(s_work) / sizeof(s_work[0]); i++)
+	{
+		pool_cyc = timepool(pool, s_work[i]);
+		thread_cyc = timethreads(nworkers, s_work[i]);
+		printf(1, "%d\t%d\t%d\n", s_work[i], pool_cyc, thread_cyc);
+	}
+	tpool_destroy(pool);
+	exit();
+}
@@ -0,0 +1,146 @@
+/*
+ * Benchmark for the pool of pages idle cpus zero ahead of time. Times
+ * fork+exec+wait of a program that exits at once, and first touch of
+ * fresh heap pages, both after sleeping so the pool is full, and right
+ * after using up the pool so every page is zeroed when it is needed.
+ *
+ * usage: user_zerobench [rounds]
+ *
+ * @author Greg Edwards
+ * @version 1.0
+ * @revisions
+ *   GJE p5  - Created
+ */
+
+#include "types.h"
+#include "user.h"
+#include "kstat.h"
+#include "x86.h"
+
+#define PGSIZE (4096)
+#define NROUNDS (20)
+#define NPAGES (64)
+#define DRAINPAGES (1024)
+
+static char* s_self;
+
+/*
+ * Pages waiting zeroed in the kernel's pool
+ * @returns the count, -1 on error
+ */
+int zeroed(void)
+{
+	struct kstat k;
+
+	return getkstat(&k) < 0 ? -1 : k.zeroed;
+}
+
+/*
+ * Uses up the pool by touching, then giving back, many fresh pages
+ */
+void drain(void)
+{
+	char* mem = sbrk(DRAINPAGES * PGSIZE);
+
+	if (mem == (char*)-1)
+	{
+		return;
+	}
+	for (int i = 0; i < DRAINPAGES; i++)
+	{
+		mem[i * PGSIZE] = 1;
+	}
+	sbrk(-DRAINPAGES * PGSIZE);
+}
+
+/*
+ * Cycles per fork+exec+wait of this program told to exit at once
+ * @param rounds number of programs to run
+ * @param empty nonzero to drain the pool before each one
+ */
+uint timeexec(int rounds, int empty)
+{
+	char* argv[] = {s_self, "-x", 0};
+	uint64 cycles = 0;
+	uint64 start;
+
+	for (int i = 0; i < rounds; i++)
+	{
+		if (empty)
+		{
+			drain();
+		}
+		else
+		{
+			sleep(2);
+		}
+		start = rdtsc();
+		if (fork() == 0)
+		{
+			exec(s_self, argv);
+			exit();
+		}
+		wait();
+		cycles += rdtsc() - start;
+	}
+	return (uint)cycles / rounds;
+}
+
+/*
+ * Cycles per page to grow the heap by NPAGES and touch them all
+ * @param rounds number of times to do it
+ * @param empty nonzero to drain the pool first each time
+ */
+uint timesbrk(int rounds, int empty)
+{
+	uint64 cycles = 0;
+	uint64 start;
+	char* mem;
+
+	for (int i = 0; i < rounds; i++)
+	{
+		if (empty)
+		{
+			drain();
+		}
+		else
+		{
+			sleep(2);
+		}
+		start = rdtsc();
+		if ((mem = sbrk(NPAGES * PGSIZE)) == (char*)-1)
+		{
+			return 0;
+		}
+		for (int j = 0; j < NPAGES; j++)
+		{
+			mem[j * PGSIZE] = 1;
+		}
+		cycles += rdtsc() - start;
+		sbrk(-NPAGES * PGSIZE);
+	}
+	return (uint)cycles / (rounds * NPAGES);
+}
+
+int main(int argc, char* argv[])
+{
+	int rounds = NROUNDS;
+
+	if (argc > 1 && strcmp(argv[1], "-x") == 0)
+	{
+		exit();
+	}
+	if (argc > 1 && (rounds = atoi(argv[1])) <= 0)
+	{
+		printf(2, "usage: user_zerobench [rounds]\n");
+		exit();
+	}
+	s_self = argv[0];
+
+	sleep(10);
+	printf(1, "%d pages zeroed in the pool\n", zeroed());
+	printf(1, "pool\texec cyc\tsbrk cyc/page\n");
+	printf(1, "full\t%d\t\t%d\n", timeexec(rounds, 0), timesbrk(rounds, 0));
+	printf(1, "empty\t%d\t\t%d\n", timeexec(rounds, 1), timesbrk(rounds, 1));
+	exit();
+}
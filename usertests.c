@@ -1376,6 +1376,8 @@ iref(void)
 // test that fork fails gracefully
 // the forktest binary also does this, but it runs out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
+// Try more forks than NPROC so one of the two limits is always hit.
+#define NFORK (NPROC + 1)
 void
 forktest(void)
 {
@@ -1383,7 +1385,7 @@ forktest(void)
 
   printf(1, "fork test\n");
 
-  for(n=0; n<1000; n++){
+  for(n=0; n<NFORK; n++){
     pid = fork();
     if(pid < 0)
       break;
@@ -1391,8 +1393,8 @@ forktest(void)
       exit();
   }
 
-  if(n == 1000){
-    printf(1, "fork claimed to work 1000 times!\n");
+  if(n == NFORK){
+    printf(1, "fork claimed to work %d times!\n", NFORK);
     exit();
   }
 
@@ -2,6 +2,19 @@
  * Revisions:
  *   GJE p3b - add clearptew
  *           - add permitptew
+ *   GJE p5  - load the thread's TLS segment in switchuvm
+ *           - add reference counted address spaces (struct mm)
+ *           - track the cpus each address space is loaded on, and
+ *             shoot down their TLBs with tlbflush()
+ *           - clearptew and permitptew leave flushing to the caller
+ *           - copy-on-write fork: copyuvm shares pages, cowbreak copies
+ *             them when written
+ *           - sbrk reserves heap pages, and uvmfault (formerly cowbreak)
+ *             allocates them when touched; copyuvm skips absent ones
+ *           - new page tables and user pages come from kalloc_zeroed()
+ *           - add uvmcopyout
+ *           - uvmshrink and uvmfault free pages only after the TLB
+ *             shootdown that makes them unreachable
  */
 #include "param.h"
 #include "types.h"
@@ -11,9 +24,24 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "slab.h"
+#include "mm.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
+static struct kcache mmcache;  // struct mm for every address space
+
+// Pages uvmfault() copies before one TLB flush frees the originals
+#define COWBATCH 16
+
+// The TLB shootdown in progress; one at a time.
+static struct {
+  struct sleeplock lock;
+  volatile int pending;        // Cpus yet to flush
+} shootdown;
 
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
@@ -37,6 +65,10 @@ seginit(void)
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
+/*
+ * @revisions
+ *   GJE p5  - Page table pages come from kalloc_zeroed()
+ */
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -47,10 +79,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
+    // Zeroed, so all those PTE_P bits are zero.
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
       return 0;
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -120,15 +151,18 @@ static struct kmap {
 };
 
 // Set up kernel part of a page table.
+/*
+ * @revisions
+ *   GJE p5  - Use kalloc_zeroed()
+ */
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
   struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
   if (P2V(PHYSTOP) > (void*)DEVSPACE)
     panic("PHYSTOP too high");
   for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
@@ -151,21 +185,41 @@ kvmalloc(void)
 
 // Switch h/w page table register to the kernel-only page table,
 // for when no process is running.
+/*
+ * @revisions
+ *   GJE p5  - Note the address space is no longer loaded here
+ */
 void
 switchkvm(void)
 {
+  struct cpu *c;
+
+  pushcli();
+  c = mycpu();
   lcr3(V2P(kpgdir));   // switch to the kernel page table
+  if(c->mm){
+    clearbit(&c->mm->cpus, c - cpus);
+    c->mm = 0;
+  }
+  popcli();
 }
 
 // Switch TSS and h/w page table to correspond to process p.
+/*
+ * @revisions
+ *   GJE p5  - Load the thread's TLS segment
+ *           - Note which address space is loaded here, for tlbflush()
+ */
 void
 switchuvm(struct proc *p)
 {
+  struct cpu *c;
+
   if(p == 0)
     panic("switchuvm: no process");
   if(p->kstack == 0)
     panic("switchuvm: no kstack");
-  if(p->pgdir == 0)
+  if(p->mm == 0 || p->mm->pgdir == 0)
     panic("switchuvm: no pgdir");
 
   pushcli();
@@ -178,12 +232,27 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
-  lcr3(V2P(p->pgdir));  // switch to process's address space
+  // The thread's %gs selects this; trapret reloads it on the way out.
+  mycpu()->gdt[SEG_UTLS] = SEG(STA_W, p->tls, 0xffffffff, DPL_USER);
+  c = mycpu();
+  if(c->mm != p->mm){
+    // Set the bit before loading so a concurrent tlbflush() can't
+    // miss us; an extra flush is harmless.
+    if(c->mm)
+      clearbit(&c->mm->cpus, c - cpus);
+    setbit(&p->mm->cpus, c - cpus);
+    c->mm = p->mm;
+  }
+  lcr3(V2P(p->mm->pgdir));  // switch to process's address space
   popcli();
 }
 
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
+/*
+ * @revisions
+ *   GJE p5  - Use kalloc_zeroed()
+ */
 void
 inituvm(pde_t *pgdir, char *init, uint sz)
 {
@@ -191,8 +260,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -223,6 +291,10 @@ loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
 
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+/*
+ * @revisions
+ *   GJE p5  - Use kalloc_zeroed()
+ */
 int
 allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
@@ -236,13 +308,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -302,6 +373,144 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
+/*
+ * Sets up the cache address spaces are allocated from.
+ * @revisions
+ *   GJE p5  - Created
+ */
+void mminit(void)
+{
+	kcache_init(&mmcache, "mm", sizeof(struct mm));
+	initsleeplock(&shootdown.lock, "shootdown");
+}
+
+/*
+ * Wraps a page table in a new address space.
+ * @param pgdir The page table, which the address space now owns
+ * @param sz Size of user memory mapped by pgdir
+ * @returns the address space with one reference, 0 if out of memory
+ * @revisions
+ *   GJE p5  - Created
+ */
+struct mm* mmalloc(pde_t* pgdir, uint sz)
+{
+	struct mm* mm;
+
+	if ((mm = kcache_alloc(&mmcache)) == 0)
+	{
+		return 0;
+	}
+	initsleeplock(&mm->lock, "mm");
+	mm->ref = 1;
+	mm->pgdir = pgdir;
+	mm->sz = sz;
+	return mm;
+}
+
+/*
+ * Takes another reference to an address space.
+ * @param mm The address space
+ * @returns mm
+ * @revisions
+ *   GJE p5  - Created
+ */
+struct mm* mmdup(struct mm* mm)
+{
+	fetch_and_add(&mm->ref, 1);
+	return mm;
+}
+
+/*
+ * Drops a reference to an address space, freeing it with the last one.
+ * Needs no lock, so it may be called holding ptable.lock.
+ * @param mm The address space, no longer loaded on this cpu if this
+ *           could be the last reference
+ * @revisions
+ *   GJE p5  - Created
+ */
+void mmput(struct mm* mm)
+{
+	if (fetch_and_add(&mm->ref, -1) != 1)
+	{
+		return;
+	}
+	freevm(mm->pgdir);
+	kcache_free(&mmcache, mm);
+}
+
+/*
+ * Makes every cpu with an address space loaded drop the translations
+ * it cached from it. Callers change any number of page table entries
+ * and then flush once; only cpus running a thread of mm are
+ * interrupted, and the flush is complete on all of them on return.
+ * Must not be called holding a spinlock: the other cpus may be
+ * spinning for it with interrupts off, and never answer.
+ * @param mm The address space whose page table changed
+ * @revisions
+ *   GJE p5  - Created
+ */
+void tlbflush(struct mm* mm)
+{
+	struct cpu* c;
+	uint others;
+	int n;
+
+	// The page table stores must be visible before we look for
+	// cpus to flush; a cpu that loads mm after this sees them.
+	__sync_synchronize();
+
+	pushcli();
+	c = mycpu();
+	if (c->mm == mm)
+	{
+		lcr3(V2P(mm->pgdir));
+	}
+	others = mm->cpus & ~(1 << (c - cpus));
+	popcli();
+	if (others == 0)
+	{
+		return;
+	}
+
+	acquiresleep(&shootdown.lock);
+	n = 0;
+	for (c = cpus; c < cpus + ncpu; c++)
+	{
+		if (others & (1 << (c - cpus)))
+		{
+			n++;
+		}
+	}
+	shootdown.pending = n;
+	// lapicipi() must not be interrupted by another IPI sent from here.
+	pushcli();
+	for (c = cpus; c < cpus + ncpu; c++)
+	{
+		if (others & (1 << (c - cpus)))
+		{
+			lapicipi(c->apicid, T_IRQ0 + IRQ_TLBFLUSH);
+		}
+	}
+	popcli();
+	while (shootdown.pending > 0)
+		;
+	releasesleep(&shootdown.lock);
+}
+
+/*
+ * Handles a tlbflush() IPI by reloading %cr3. The cpu may have switched
+ * to another address space since it was sent; flushing is still safe.
+ * @revisions
+ *   GJE p5  - Created
+ */
+void tlbflushintr(void)
+{
+	struct cpu* c = mycpu();
+
+	lcr3(V2P(c->mm ? c->mm->pgdir : kpgdir));
+	fetch_and_add((int*)&shootdown.pending, -1);
+}
+
 // Clear PTE_U on a page. Used to create an inaccessible
 // page beneath the user stack.
 void
@@ -322,6 +531,7 @@ clearpteu(pde_t *pgdir, char *uva)
  *   uva   (in) - pointer to user virtual address page
  * Revisions:
  *   GJE p3b - Created
+ *   GJE p5  - Caller flushes with tlbflush(), once for a batch of pages
  */
 void clearptew(pde_t* pgdir, char* uva)
 {
@@ -331,9 +541,7 @@ void clearptew(pde_t* pgdir, char* uva)
 	{
 		panic("clearptew");
 	}
-	*pte &= ~PTE_W;
-	// update page tabe base to register changes
-	lcr3(V2P(pgdir));
+	*pte &= ~(PTE_W | PTE_COW);
 }
 
 /*
@@ -343,6 +551,8 @@ void clearptew(pde_t* pgdir, char* uva)
  *   uva   (in) - pointer to user virtual address page
  * Revisions:
  *   GJE p3b - Created
+ *   GJE p5  - Caller flushes with tlbflush(), once for a batch of pages
+ *           - A page shared with another process becomes copy-on-write
  */
 void permitptew(pde_t* pgdir, char* uva)
 {
@@ -352,38 +562,51 @@ void permitptew(pde_t* pgdir, char* uva)
 	{
 		panic("permitptew");
 	}
-	*pte |= PTE_W;
-	// update page tabe base to register changes
-	lcr3(V2P(pgdir));
+	if (*pte & PTE_W)
+	{
+		return;
+	}
+	if ((*pte & PTE_P) && krefs(P2V(PTE_ADDR(*pte))) > 1)
+	{
+		*pte |= PTE_COW;
+	}
+	else
+	{
+		*pte |= PTE_W;
+	}
 }
 
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. The two share every page; writable ones
+// become copy-on-write in both, so the caller must tlbflush()
+// the parent.
+/*
+ * @revisions
+ *   GJE p5  - Share pages copy-on-write instead of copying them
+ *           - Skip heap pages not yet allocated
+ */
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
-    if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+    // Heap pages reserved but never touched stay that way.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    // Pages the user made read-only stay that way, and aren't COW.
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
-    }
+    kref(P2V(pa));
   }
   return d;
 
@@ -392,15 +615,211 @@ bad:
   return 0;
 }
 
+/*
+ * Gives one page its own copy, if another page table shares it, and
+ * makes it writable. Caller holds the page table's mm lock, and must
+ * kfree() the old page, but only once other cpus' TLBs are flushed.
+ * @param pte The page's copy-on-write page table entry
+ * @param old OUTPUT the page replaced, if it was copied
+ * @returns 1 if the page was copied, 0 if made writable in place,
+ *          -1 if out of memory
+ * @revisions
+ *   GJE p5  - Created
+ *           - Leave freeing the old page to the caller
+ */
+static int cowcopy(pte_t* pte, char** old)
+{
+	char* mem;
+	uint flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+
+	*old = P2V(PTE_ADDR(*pte));
+	// Whoever else had it has copied it or gone; it's ours now.
+	if (krefs(*old) == 1)
+	{
+		*pte = PTE_ADDR(*pte) | flags;
+		return 0;
+	}
+	if ((mem = kalloc()) == 0)
+	{
+		return -1;
+	}
+	memmove(mem, *old, PGSIZE);
+	*pte = V2P(mem) | flags;
+	return 1;
+}
+
+/*
+ * Flushes the TLBs of an address space's cpus, then drops the pages
+ * that stale entries there could still reach. Caller holds mm->lock.
+ * @param mm The address space
+ * @param pages The pages unmapped from it
+ * @param n Number of pages
+ * @revisions
+ *   GJE p5  - Created
+ */
+static void flushfree(struct mm* mm, char** pages, int n)
+{
+	tlbflush(mm);
+	for (int i = 0; i < n; i++)
+	{
+		kfree(pages[i]);
+	}
+}
+
+/*
+ * Shrinks a live address space, which other cpus may have loaded:
+ * unmaps the pages, flushes the TLBs, and only then frees the pages,
+ * so no stale translation reaches a page after it's reused. Pages
+ * are marked not present first, keeping their address for the free.
+ * Caller holds mm->lock.
+ * @param mm The address space
+ * @param oldsz Its size
+ * @param newsz Size to shrink it to
+ * @returns the new size
+ * @revisions
+ *   GJE p5  - Created
+ */
+uint uvmshrink(struct mm* mm, uint oldsz, uint newsz)
+{
+	pte_t* pte;
+	uint a;
+	int n = 0;
+
+	if (newsz >= oldsz)
+	{
+		return oldsz;
+	}
+	for (a = PGROUNDUP(newsz); a < oldsz; a += PGSIZE)
+	{
+		if ((pte = walkpgdir(mm->pgdir, (char*)a, 0)) == 0)
+		{
+			a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+		}
+		else if (*pte & PTE_P)
+		{
+			*pte &= ~PTE_P;
+			n++;
+		}
+	}
+	if (n == 0)
+	{
+		return newsz;
+	}
+	tlbflush(mm);
+	for (a = PGROUNDUP(newsz); a < oldsz; a += PGSIZE)
+	{
+		if ((pte = walkpgdir(mm->pgdir, (char*)a, 0)) == 0)
+		{
+			a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+		}
+		else if (*pte != 0)
+		{
+			kfree(P2V(PTE_ADDR(*pte)));
+			*pte = 0;
+		}
+	}
+	return newsz;
+}
+
+/*
+ * Resolves a fault on user memory, or prevents one: on a page fault,
+ * and in system calls before the kernel touches user memory where it
+ * can't take a fault, such as under a spinlock. Heap pages sbrk() has
+ * reserved get a zeroed page the first time they're touched, and on a
+ * write, copy-on-write pages get their own copy. Pages already as
+ * wanted are left alone, so a fault another thread beat us to is
+ * resolved too. Other cpus are flushed only if pages moved; ones
+ * holding stale read-only entries fault and find the page done.
+ * @param mm The address space
+ * @param va Start of the range
+ * @param len Length of the range; at least one page is done
+ * @param write Nonzero if the range must be writable
+ * @returns 0 if every page is user memory, present and writable if
+ *          asked; -1 if any isn't, or memory ran out
+ * @revisions
+ *   GJE p5  - Created, as cowbreak
+ *           - Allocate lazily reserved heap pages; renamed uvmfault
+ *           - Use kalloc_zeroed()
+ *           - Free the pages it replaced only after the TLB flush
+ */
+int uvmfault(struct mm* mm, uint va, uint len, int write)
+{
+	pte_t* pte;
+	char* mem;
+	char* old;
+	char* stale[COWBATCH];  // copied pages to free after a flush
+	int nstale = 0;
+	uint a;
+	uint last;
+	int ret = 0;
+	int r;
+
+	last = PGROUNDDOWN(va + (len > 0 ? len - 1 : 0));
+	acquiresleep(&mm->lock);
+	for (a = PGROUNDDOWN(va); ret == 0 && a <= last; a += PGSIZE)
+	{
+		if (a >= mm->sz || (pte = walkpgdir(mm->pgdir, (char*)a, 1)) == 0)
+		{
+			ret = -1;
+		}
+		else if (!(*pte & PTE_P))
+		{
+			// Not touched since sbrk() reserved it
+			if ((mem = kalloc_zeroed()) == 0)
+			{
+				ret = -1;
+			}
+			else
+			{
+				*pte = V2P(mem) | PTE_P | PTE_W | PTE_U;
+			}
+		}
+		else if (!(*pte & PTE_U))
+		{
+			ret = -1;
+		}
+		else if (write && (*pte & PTE_COW))
+		{
+			if ((r = cowcopy(pte, &old)) < 0)
+			{
+				ret = -1;
+			}
+			else if (r == 1)
+			{
+				stale[nstale++] = old;
+			}
+			if (nstale == COWBATCH)
+			{
+				flushfree(mm, stale, nstale);
+				nstale = 0;
+			}
+		}
+		else if (write && !(*pte & PTE_W))
+		{
+			ret = -1;
+		}
+	}
+	if (nstale > 0)
+	{
+		flushfree(mm, stale, nstale);
+	}
+	releasesleep(&mm->lock);
+	return ret;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
+/*
+ * @revisions
+ *   GJE p5  - No page table there is not a kernel address either
+ */
 char*
 uva2ka(pde_t *pgdir, char *uva)
 {
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -409,7 +828,12 @@ uva2ka(pde_t *pgdir, char *uva)
 
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
-// uva2ka ensures this only works for PTE_U pages.
+// uva2ka ensures this only works for PTE_U pages; pages still
+// shared copy-on-write are refused, so uvmfault() them first.
+/*
+ * @revisions
+ *   GJE p5  - Refuse copy-on-write pages
+ */
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
@@ -420,7 +844,7 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
     pa0 = uva2ka(pgdir, (char*)va0);
-    if(pa0 == 0)
+    if(pa0 == 0 || (*walkpgdir(pgdir, (char*)va0, 0) & PTE_COW))
       return -1;
     n = PGSIZE - (va - va0);
     if(n > len)
@@ -433,6 +857,32 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   return 0;
 }
 
+/*
+ * Copies from the kernel to user memory of an address space, making
+ * the pages present and writable first. For the kernel writing user
+ * memory after sleeping, when a sibling thread may have forked and
+ * left the pages copy-on-write. Call without spinlocks held.
+ * @param mm The address space
+ * @param va User address to copy to
+ * @param p Kernel address to copy from
+ * @param len Number of bytes
+ * @returns 0 if sucessful, -1 if the range isn't writable user memory
+ * @revisions
+ *   GJE p5  - Created
+ */
+int uvmcopyout(struct mm* mm, uint va, void* p, uint len)
+{
+	if (len == 0)
+	{
+		return 0;
+	}
+	if (uvmfault(mm, va, len, 1) < 0)
+	{
+		return -1;
+	}
+	return copyout(mm->pgdir, va, p, len);
+}
+
 //PAGEBREAK!
 // Blank page.
 //PAGEBREAK!
@@ -1,6 +1,11 @@
 /*
  * @revisisons
  *   GJE p4b - add atomic fetch_and_add instruction
+ *   GJE p5  - add rdtsc
+ *           - add stihlt
+ *           - add udiv64
+ *           - add cmpxchg
+ *           - add setbit and clearbit
  */
 
 // Routines to let C code use special x86 instructions.
@@ -122,6 +127,15 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and halt until one arrives. sti takes effect
+// only after the following instruction, so an interrupt can't be
+// taken between the two and leave the cpu halted with work to do.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -149,6 +163,30 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+// Read the time-stamp counter.
+static inline uint64
+rdtsc(void)
+{
+  uint64 val;
+  asm volatile("rdtsc" : "=A" (val));
+  return val;
+}
+
+// Divide a 64-bit value by a 32-bit one without libgcc's __udivdi3.
+static inline uint64
+udiv64(uint64 n, uint d)
+{
+  uint hi = n >> 32;
+  uint lo = n;
+  uint qhi = hi / d;
+  uint qlo;
+  uint r = hi % d;
+
+  // r < d, so the quotient of r:lo fits in 32 bits.
+  asm volatile("divl %4" : "=a" (qlo), "=d" (r) : "a" (lo), "d" (r), "rm" (d));
+  return ((uint64)qhi << 32) | qlo;
+}
+
 /*
  * Atomic fetch and add instruction for x86 gcc compiler
  * @param pvariable pointer to variable to add value to
@@ -166,6 +204,56 @@ static inline int fetch_and_add(int* pvariable, int value)
 	return value;
 }
 
+/*
+ * Atomic compare and exchange instruction for x86 gcc compiler
+ * @param pvariable pointer to variable to update
+ * @param expected value *pvariable must hold to be replaced
+ * @param value value to store in *pvariable
+ * @returns the value *pvariable held; the store happened if it equals expected
+ * @revisions
+ *   GJE p5  - Created
+ */
+static inline int cmpxchg(volatile int* pvariable, int expected, int value)
+{
+	int prev;
+
+	asm volatile("lock; cmpxchgl %2, %1"
+		: "=a" (prev), "+m" (*pvariable)
+		: "r" (value), "0" (expected)
+		: "memory");
+	return prev;
+}
+
+/*
+ * Atomically sets one bit of a word
+ * @param pvariable pointer to the word
+ * @param bit index of the bit, 0 to 31
+ * @revisions
+ *   GJE p5  - Created
+ */
+static inline void setbit(volatile uint* pvariable, int bit)
+{
+	asm volatile("lock; btsl %1, %0"
+		: "+m" (*pvariable)
+		: "r" (bit)
+		: "memory");
+}
+
+/*
+ * Atomically clears one bit of a word
+ * @param pvariable pointer to the word
+ * @param bit index of the bit, 0 to 31
+ * @revisions
+ *   GJE p5  - Created
+ */
+static inline void clearbit(volatile uint* pvariable, int bit)
+{
+	asm volatile("lock; btrl %1, %0"
+		: "+m" (*pvariable)
+		: "r" (bit)
+		: "memory");
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().